@@ -0,0 +1,512 @@
+#define _DEFAULT_SOURCE // For sysconf(_SC_NPROCESSORS_ONLN)
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "emulate.h"
+#include "batch.h"
+#include "lockstep.h"
+#include "snapshot.h"
+#include "image.h"
+#ifdef JIT
+#include "jit.h"
+#endif
+
+// Runs many independent programs without a window
+//
+// Each worker thread owns one CPU, which is reset for every job it runs.
+// Jobs are handed out as a contiguous range per worker.
+// A worker that runs out steals the top half of another worker's range,
+// so uneven jobs still keep every core busy until the end.
+//
+// With lockstep, consecutive jobs with the same image and limits are grouped,
+// and each group is handed out as one unit and run on the vector core in lockstep.c.
+// Lanes it can't keep together finish on the worker's CPU,
+// running the same slices a scalar run would, so the results don't depend on lockstep.
+
+#define BATCH_SLICE 0x10000 // Most instructions run between limit checks
+#define MAX_LINE_LENGTH 4096
+
+typedef struct {
+    uint16_t address;
+    uint8_t value;
+} batchPoke;
+
+typedef struct {
+    const char* fileName;
+    const uint8_t* image; // Shared by every job using the same file
+    const snapshot* start; // Set instead of image for jobs that start from a snapshot
+    uint64_t instructionLimit; // 0 for no limit
+    uint64_t cycleLimit; // 0 for no limit
+    batchPoke* pokes; // Written after the image is loaded
+    uint32_t pokeCount;
+
+    // Results
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t digest;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t AC;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P;
+    bool halted;
+} batchJob;
+
+typedef struct {
+    char* fileName;
+    uint8_t* image;
+    snapshot* start;
+} batchImage;
+
+// The jobs left for one worker, next in the low 32 bits and end in the high 32 bits
+// Both halves change together, so the owner and thieves can't take the same job
+// Padded so each worker's range is on its own cache line
+typedef struct {
+    _Atomic uint64_t range;
+    uint8_t padding[64 - sizeof(uint64_t)];
+} jobQueue;
+
+// Jobs handed out together, more than one only when running in lockstep
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} batchUnit;
+
+typedef struct {
+    batchJob* jobs;
+    batchUnit* units;
+    jobQueue* queues;
+    uint32_t workerCount;
+} batchState;
+
+typedef struct {
+    batchState* batch;
+    uint32_t index;
+    pthread_t thread;
+} batchWorker;
+
+static uint64_t packRange(const uint32_t next, const uint32_t end) {
+    return (uint64_t)end << 32 | next;
+}
+
+static bool takeJob(jobQueue * const queue, uint32_t * const job) {
+    uint64_t range = atomic_load(&queue->range);
+    for (;;) {
+        const uint32_t next = range & 0xffffffff;
+        const uint32_t end = range >> 32;
+        if (next == end) return false;
+
+        // On failure range is reloaded with the current value
+        if (atomic_compare_exchange_weak(&queue->range, &range, packRange(next + 1, end))) {
+            *job = next;
+            return true;
+        }
+    }
+}
+
+// Moves the top half of another worker's jobs to this worker's empty range
+static bool stealJobs(const batchWorker * const worker) {
+    const batchState * const batch = worker->batch;
+
+    for (uint32_t i = 1; i < batch->workerCount; i++) {
+        jobQueue * const victim = &batch->queues[(worker->index + i) % batch->workerCount];
+        uint64_t range = atomic_load(&victim->range);
+
+        for (;;) {
+            const uint32_t next = range & 0xffffffff;
+            const uint32_t end = range >> 32;
+            if (next == end) break;
+
+            const uint32_t middle = next + (end - next) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &range, packRange(next, middle))) {
+                // Nobody else changes an empty range, so a plain store is safe
+                atomic_store(&batch->queues[worker->index].range, packRange(middle, end));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// FNV-1a
+static uint64_t digestMemory(const uint8_t * const mem) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (uint32_t i = 0; i < 0x10000; i++) {
+        hash ^= mem[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// The number of instructions to run before checking the limits again, 0 once a limit is reached
+static uint32_t getSlice(const cpu6502 * const cpu, const batchJob * const job, const uint64_t instructions) {
+    return limitInstructions(cpu, BATCH_SLICE, instructions, job->instructionLimit);
+}
+
+// Lockstep groups have no deadline, but nothing that runs in lockstep takes more than 8 cycles,
+// so they can't start an instruction at or past the cycle limit while their slices are kept to this
+static uint32_t getGroupSlice(const batchJob * const job, const uint64_t instructions, const uint64_t cycles) {
+    uint32_t count = BATCH_SLICE;
+    if (job->instructionLimit) {
+        if (instructions >= job->instructionLimit) return 0;
+        if (job->instructionLimit - instructions < count) count = job->instructionLimit - instructions;
+    }
+
+    if (job->cycleLimit) {
+        if (cycles >= job->cycleLimit) return 0;
+        const uint64_t cycleCount = job->cycleLimit - cycles < 8 ? 1 : (job->cycleLimit - cycles) / 8;
+        if (cycleCount < count) count = cycleCount;
+    }
+
+    return count;
+}
+
+// Restoring a snapshot keeps cached code, so pokes have to invalidate it like any other write
+static void applyPokes(cpu6502 * const cpu, const batchJob * const job) {
+    for (uint32_t i = 0; i < job->pokeCount; i++) {
+        const uint16_t address = job->pokes[i].address;
+        cpu->mem[address] = job->pokes[i].value;
+        checkCodeWrite(cpu, address);
+    }
+}
+
+// Runs the job to the end from wherever cpu is
+// remaining is what's left of the slice it was partway through
+static void finishJob(cpu6502 * const cpu, batchJob * const job, uint64_t instructions, const uint32_t remaining) {
+    setCycleLimit(cpu, job->cycleLimit);
+    if (remaining) instructions += runInstructions(cpu, remaining);
+
+    while (!cpu->halted) {
+        const uint32_t count = getSlice(cpu, job, instructions);
+        if (!count) break;
+        instructions += runInstructions(cpu, count);
+
+        // Batch CPUs have no keyboard, so only the timer can end an idle loop before the limit
+        idleLoop loop;
+        instructions += findIdleLoop(cpu, limitInstructions(cpu, MAX_IDLE_LOOP, instructions, job->instructionLimit), &loop);
+        instructions += skipIdleLoop(cpu, &loop, instructions, job->instructionLimit);
+    }
+
+    job->instructions = instructions;
+    job->cycles = cpu->cycles;
+    job->digest = digestMemory(cpu->mem);
+    job->PC = cpu->PC;
+    job->SP = cpu->SP;
+    job->AC = cpu->AC;
+    job->X = cpu->X;
+    job->Y = cpu->Y;
+    job->P = getStatus(cpu);
+    job->halted = cpu->halted;
+}
+
+static void runJob(cpu6502 * const cpu, batchJob * const job) {
+    if (job->start) {
+        restoreSnapshot(cpu, job->start);
+    } else {
+        resetCpu(cpu, job->image);
+    }
+    applyPokes(cpu, job);
+    finishJob(cpu, job, 0, 0);
+}
+
+typedef struct {
+    batchJob* jobs; // The group's first job, in lane 0
+    uint64_t instructions; // Run by every lane still in the group
+    uint32_t count; // Size of the current slice
+} groupProgress;
+
+static void leaveGroup(void * const context, const uint32_t lane, cpu6502 * const cpu, const uint32_t ran) {
+    const groupProgress * const progress = context;
+    finishJob(cpu, &progress->jobs[lane], progress->instructions + ran, progress->count - ran);
+}
+
+// Every job in the group has the same image and limits, so they all take the same slices
+static void runGroup(cpu6502 * const cpu, lockstepGroup * const group, batchJob * const jobs, const uint32_t jobCount) {
+    resetLockstep(group, jobs[0].image, jobCount);
+    for (uint32_t lane = 0; lane < jobCount; lane++) {
+        for (uint32_t i = 0; i < jobs[lane].pokeCount; i++) pokeLockstep(group, lane, jobs[lane].pokes[i].address, jobs[lane].pokes[i].value);
+    }
+
+    groupProgress progress = { .jobs = jobs };
+    while (!isLockstepEmpty(group)) {
+        progress.count = getGroupSlice(&jobs[0], progress.instructions, getLockstepCycles(group));
+        if (!progress.count) {
+            finishLockstep(group, cpu, &leaveGroup, &progress);
+            break;
+        }
+        progress.instructions += runLockstep(group, progress.count, cpu, &leaveGroup, &progress);
+    }
+}
+
+static void* runWorker(void* args) {
+    const batchWorker * const worker = args;
+
+    cpu6502 * const cpu = createCpu();
+
+    #ifdef JIT
+    initJit(cpu);
+    #endif
+
+    lockstepGroup* group = NULL; // Only created if this worker gets a group
+
+    for (;;) {
+        uint32_t index;
+        if (takeJob(&worker->batch->queues[worker->index], &index)) {
+            const batchUnit * const unit = &worker->batch->units[index];
+            batchJob * const jobs = &worker->batch->jobs[unit->first];
+
+            if (unit->count == 1) {
+                runJob(cpu, jobs);
+            } else {
+                if (!group) group = createLockstep();
+                runGroup(cpu, group, jobs, unit->count);
+            }
+        } else if (!stealJobs(worker)) {
+            break;
+        }
+    }
+
+    if (group) destroyLockstep(group);
+    destroyCpu(cpu);
+    return NULL;
+}
+
+static uint32_t getHostThreads(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+    #else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+    #endif
+}
+
+static uint64_t parseLimit(const char * const string, const char * const manifestName, const uint32_t line) {
+    char* end;
+    const unsigned long long limit = strtoull(string, &end, 10);
+    if (end == string || *end != '\0' || string[0] == '-') {
+        printf("%s:%u: Invalid limit: %s\n", manifestName, line, string);
+        exit(1);
+    }
+    return limit;
+}
+
+static batchPoke parsePoke(const char * const string, const char * const manifestName, const uint32_t line) {
+    char* end;
+    const unsigned long address = strtoul(string, &end, 16);
+    if (end == string || *end != ':' || string[0] == '-' || address > 0xffff) {
+        printf("%s:%u: Invalid poke: %s\n", manifestName, line, string);
+        exit(1);
+    }
+
+    const char * const valueString = end + 1;
+    const unsigned long value = strtoul(valueString, &end, 16);
+    if (end == valueString || *end != '\0' || valueString[0] == '-' || value > 0xff) {
+        printf("%s:%u: Invalid poke: %s\n", manifestName, line, string);
+        exit(1);
+    }
+
+    return (batchPoke){ .address = address, .value = value };
+}
+
+// Loads each image once, however many jobs use it
+// Returns the image's index in images
+static uint32_t findImage(batchImage** images, uint32_t * const imageCount, const char * const fileName) {
+    for (uint32_t i = 0; i < *imageCount; i++) {
+        if (strcmp((*images)[i].fileName, fileName) == 0) return i;
+    }
+
+    *images = realloc(*images, (*imageCount + 1) * sizeof(batchImage));
+    char * const name = malloc(strlen(fileName) + 1);
+    if (!*images || !name) {
+        printf("Failed to allocate memory for the batch\n");
+        exit(1);
+    }
+    strcpy(name, fileName);
+
+    batchImage loaded = { .fileName = name };
+    if (isSnapshotFile(fileName)) {
+        loaded.start = createSnapshot();
+        readSnapshot(loaded.start, fileName);
+    } else {
+        loaded.image = malloc(0x10000);
+        if (!loaded.image) {
+            printf("Failed to allocate memory for the batch\n");
+            exit(1);
+        }
+        readFile(loaded.image, fileName);
+    }
+
+    (*images)[*imageCount] = loaded;
+    return (*imageCount)++;
+}
+
+// Each line is an image or snapshot file followed by its limits, e.g.
+// tests/sort.6502 instructions=1000000 cycles=5000000 poke=0200:2a
+// Blank lines and lines starting with # are ignored
+static batchJob* readManifest(const char * const manifestName, uint32_t * const jobCount, batchImage** images, uint32_t * const imageCount) {
+    FILE * const manifest = fopen(manifestName, "r");
+    if (!manifest) {
+        printf("Failed to open file: %s\n", manifestName);
+        exit(1);
+    }
+
+    batchJob* jobs = NULL;
+    uint32_t capacity = 0;
+    char text[MAX_LINE_LENGTH];
+
+    for (uint32_t line = 1; fgets(text, sizeof text, manifest); line++) {
+        if (!strchr(text, '\n') && !feof(manifest)) {
+            printf("%s:%u: Line is too long\n", manifestName, line);
+            exit(1);
+        }
+
+        const char * const fileName = strtok(text, " \t\r\n");
+        if (!fileName || fileName[0] == '#') continue;
+
+        batchJob job = { 0 };
+
+        for (const char* option = strtok(NULL, " \t\r\n"); option; option = strtok(NULL, " \t\r\n")) {
+            if (strncmp(option, "instructions=", 13) == 0) {
+                job.instructionLimit = parseLimit(option + 13, manifestName, line);
+            } else if (strncmp(option, "cycles=", 7) == 0) {
+                job.cycleLimit = parseLimit(option + 7, manifestName, line);
+            } else if (strncmp(option, "poke=", 5) == 0) {
+                job.pokes = realloc(job.pokes, (job.pokeCount + 1) * sizeof(batchPoke));
+                if (!job.pokes) {
+                    printf("Failed to allocate memory for the batch\n");
+                    exit(1);
+                }
+                job.pokes[job.pokeCount++] = parsePoke(option + 5, manifestName, line);
+            } else {
+                printf("%s:%u: Unexpected option: %s\n", manifestName, line, option);
+                exit(1);
+            }
+        }
+
+        // Without a limit a program that never halts would hold up the whole batch
+        if (!job.instructionLimit && !job.cycleLimit) {
+            printf("%s:%u: Expected an instruction or cycle limit\n", manifestName, line);
+            exit(1);
+        }
+
+        const uint32_t image = findImage(images, imageCount, fileName);
+        job.fileName = (*images)[image].fileName;
+        job.image = (*images)[image].image;
+        job.start = (*images)[image].start;
+
+        if (*jobCount == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            jobs = realloc(jobs, capacity * sizeof(batchJob));
+            if (!jobs) {
+                printf("Failed to allocate memory for the batch\n");
+                exit(1);
+            }
+        }
+        jobs[(*jobCount)++] = job;
+    }
+
+    fclose(manifest);
+    return jobs;
+}
+
+// Splits the jobs into the units handed to workers
+// Returns the number of units
+static uint32_t groupJobs(const batchJob * const jobs, const uint32_t jobCount, batchUnit * const units, const bool lockstep) {
+    uint32_t unitCount = 0;
+
+    for (uint32_t i = 0; i < jobCount;) {
+        uint32_t count = 1;
+        // Lockstep groups start from reset, so jobs from snapshots run on their own
+        if (lockstep && !jobs[i].start) {
+            while (i + count < jobCount && count < LOCKSTEP_LANES
+                && jobs[i + count].image == jobs[i].image
+                && jobs[i + count].instructionLimit == jobs[i].instructionLimit
+                && jobs[i + count].cycleLimit == jobs[i].cycleLimit) count++;
+        }
+
+        units[unitCount++] = (batchUnit){ .first = i, .count = count };
+        i += count;
+    }
+
+    return unitCount;
+}
+
+void runBatch(const char * const manifestName, uint32_t threadCount, const bool lockstep) {
+    batchImage* images = NULL;
+    uint32_t imageCount = 0;
+    uint32_t jobCount = 0;
+    batchJob * const jobs = readManifest(manifestName, &jobCount, &images, &imageCount);
+
+    batchUnit * const units = malloc((jobCount ? jobCount : 1) * sizeof(batchUnit));
+    if (!units) {
+        printf("Failed to allocate memory for the batch\n");
+        exit(1);
+    }
+    const uint32_t unitCount = groupJobs(jobs, jobCount, units, lockstep);
+
+    if (threadCount == 0) threadCount = getHostThreads();
+    if (threadCount > unitCount) threadCount = unitCount;
+
+    batchState batch = {
+        .jobs = jobs,
+        .units = units,
+        .queues = calloc(threadCount ? threadCount : 1, sizeof(jobQueue)),
+        .workerCount = threadCount
+    };
+    batchWorker * const workers = calloc(threadCount ? threadCount : 1, sizeof(batchWorker));
+    if (!batch.queues || !workers) {
+        printf("Failed to allocate memory for the batch\n");
+        exit(1);
+    }
+
+    // Start each worker with an equal share of the jobs
+    for (uint32_t i = 0; i < threadCount; i++) {
+        const uint32_t first = (uint64_t)unitCount * i / threadCount;
+        const uint32_t last = (uint64_t)unitCount * (i + 1) / threadCount;
+        atomic_init(&batch.queues[i].range, packRange(first, last));
+        workers[i] = (batchWorker){ .batch = &batch, .index = i };
+    }
+
+    for (uint32_t i = 0; i < threadCount; i++) {
+        if (pthread_create(&workers[i].thread, NULL, &runWorker, &workers[i]) != 0) {
+            printf("Failed to create worker thread\n");
+            exit(1);
+        }
+    }
+
+    for (uint32_t i = 0; i < threadCount; i++) pthread_join(workers[i].thread, NULL);
+
+    // Results are written in manifest order, however the jobs were scheduled
+    for (uint32_t i = 0; i < jobCount; i++) {
+        const batchJob * const job = &jobs[i];
+        printf("%u %s %s PC=%.4x SP=%.2x A=%.2x X=%.2x Y=%.2x P=%.2x instructions=%llu cycles=%llu mem=%.16llx\n",
+            i, job->fileName, job->halted ? "halted" : "limit",
+            job->PC, job->SP, job->AC, job->X, job->Y, job->P,
+            (unsigned long long)job->instructions, (unsigned long long)job->cycles, (unsigned long long)job->digest);
+    }
+
+    for (uint32_t i = 0; i < imageCount; i++) {
+        free(images[i].fileName);
+        free(images[i].image);
+        if (images[i].start) destroySnapshot(images[i].start);
+    }
+    for (uint32_t i = 0; i < jobCount; i++) free(jobs[i].pokes);
+    free(images);
+    free(units);
+    free(workers);
+    free(batch.queues);
+    free(jobs);
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Runs every job in the manifest on a pool of worker threads, then prints each job's final registers and memory digest
+// threadCount is the number of workers, 0 for one per host CPU
+// lockstep runs jobs sharing an image and limits together on the vector core
+void runBatch(const char* manifestName, uint32_t threadCount, bool lockstep);
\ No newline at end of file
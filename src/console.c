@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "console.h"
+
+// Console output
+//
+// Writing each byte to the file as the program stores it means taking the stdio lock,
+// and often a system call, in the middle of running instructions.
+// Instead the CPU thread adds bytes to a ring buffer, and a writer thread takes them out in batches,
+// with one fwrite for each contiguous run and one fflush for the batch.
+//
+// The CPU thread decides when output is due by the flush policy, and moves flushTo up to the end of it.
+// The writer only sleeps when nothing is due, and says so first, so the CPU thread only takes the lock
+// to wake it when it's actually asleep. With FLUSH_TIME nothing is due until the writer's timer runs out,
+// and the timer only runs while there's output waiting, so a program that prints nothing leaves the writer asleep.
+
+#define CONSOLE_BUFFER_SIZE 0x10000 // Must be a power of 2
+#define MAX_FORMATTED 256
+
+struct consoleOutput {
+    uint8_t buffer[CONSOLE_BUFFER_SIZE];
+    FILE* file;
+    flushPolicy policy;
+    uint32_t flushSize;
+    uint32_t flushTime; // Milliseconds
+    bool block;
+
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Signalled for the writer when output is due or it should stop
+    pthread_cond_t written; // Signalled for the CPU thread after each batch is written out
+    bool stopping; // Guarded by lock
+
+    // Count up forever and wrap, each is only written by one thread
+    // Kept on separate cache lines so adding and writing out don't contend
+    _Alignas(64) _Atomic uint32_t tail; // Written by the CPU thread
+    _Atomic uint32_t flushTo; // Written by the CPU thread, everything before this is due to be written out
+    _Atomic uint32_t dropped; // Bytes lost to a full buffer since the writer last reported them
+    _Alignas(64) _Atomic uint32_t head; // Written by the writer
+    _Atomic bool sleeping; // Set by the writer before it waits
+    _Atomic bool idle; // Set by the writer before it waits with no timer running, FLUSH_TIME only
+};
+
+static void writeOutput(consoleOutput * const console, const uint32_t head, const uint32_t end) {
+    const uint32_t first = head % CONSOLE_BUFFER_SIZE;
+    const uint32_t length = end - head;
+    const uint32_t untilWrap = CONSOLE_BUFFER_SIZE - first;
+
+    if (length <= untilWrap) {
+        fwrite(console->buffer + first, 1, length, console->file);
+    } else {
+        fwrite(console->buffer + first, 1, untilWrap, console->file);
+        fwrite(console->buffer, 1, length - untilWrap, console->file);
+    }
+
+    const uint32_t dropped = atomic_exchange_explicit(&console->dropped, 0, memory_order_relaxed);
+    if (dropped) fprintf(console->file, "\n[%u bytes of console output dropped]\n", dropped);
+    fflush(console->file);
+
+    atomic_store_explicit(&console->head, end, memory_order_release);
+}
+
+// Where output is due up to, everything added when the timer has run out or the writer is stopping
+static uint32_t dueOutput(consoleOutput * const console, const bool timeUp) {
+    if (timeUp || console->stopping) return atomic_load_explicit(&console->tail, memory_order_acquire);
+    return atomic_load(&console->flushTo);
+}
+
+static void* runWriter(void* args) {
+    consoleOutput * const console = args;
+    bool timeUp = false;
+
+    pthread_mutex_lock(&console->lock);
+    for (;;) {
+        const uint32_t head = atomic_load_explicit(&console->head, memory_order_relaxed);
+        uint32_t end = dueOutput(console, timeUp);
+        timeUp = false;
+
+        // The timer can write out past flushTo, leaving it behind head
+        if ((int32_t)(end - head) > 0) {
+            pthread_mutex_unlock(&console->lock);
+            writeOutput(console, head, end);
+            pthread_mutex_lock(&console->lock);
+            pthread_cond_broadcast(&console->written);
+            continue;
+        }
+        if (console->stopping) break;
+
+        // Checking again after saying it's asleep means output can't become due unseen
+        atomic_store(&console->sleeping, true);
+        end = dueOutput(console, false);
+        if ((int32_t)(end - head) <= 0) {
+            // The timer is only started once there's something for it to write out
+            // Saying it's idle before looking means the first byte can't be added unseen, see putConsole
+            if (console->policy == FLUSH_TIME) atomic_store(&console->idle, true);
+            if (console->policy == FLUSH_TIME && atomic_load(&console->tail) != head) {
+                atomic_store(&console->idle, false);
+                struct timespec deadline;
+                timespec_get(&deadline, TIME_UTC);
+                deadline.tv_nsec += (long)console->flushTime * 1000000;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000;
+                deadline.tv_nsec %= 1000000000;
+                timeUp = pthread_cond_timedwait(&console->wake, &console->lock, &deadline) == ETIMEDOUT;
+            } else {
+                pthread_cond_wait(&console->wake, &console->lock);
+            }
+            atomic_store(&console->idle, false);
+        }
+        atomic_store(&console->sleeping, false);
+    }
+    pthread_mutex_unlock(&console->lock);
+    return NULL;
+}
+
+consoleOutput* createConsole(FILE * const file, const flushPolicy policy, const uint32_t amount, const bool block) {
+    consoleOutput * const console = calloc(1, sizeof(consoleOutput));
+    if (!console) {
+        printf("Failed to allocate memory for the console\n");
+        exit(1);
+    }
+
+    console->file = file;
+    console->policy = policy;
+    console->flushSize = policy == FLUSH_SIZE && amount ? amount : DEFAULT_FLUSH_SIZE;
+    console->flushTime = policy == FLUSH_TIME && amount ? amount : DEFAULT_FLUSH_TIME;
+    console->block = block;
+
+    // The buffer is written out at half full whatever the policy, so larger sizes would never be reached
+    if (console->flushSize > CONSOLE_BUFFER_SIZE / 2) console->flushSize = CONSOLE_BUFFER_SIZE / 2;
+
+    pthread_mutex_init(&console->lock, NULL);
+    pthread_cond_init(&console->wake, NULL);
+    pthread_cond_init(&console->written, NULL);
+    if (pthread_create(&console->writer, NULL, &runWriter, console)) {
+        printf("Failed to create the console writer thread\n");
+        exit(1);
+    }
+    return console;
+}
+
+void destroyConsole(consoleOutput * const console) {
+    pthread_mutex_lock(&console->lock);
+    console->stopping = true;
+    pthread_cond_signal(&console->wake);
+    pthread_mutex_unlock(&console->lock);
+    pthread_join(console->writer, NULL);
+
+    pthread_cond_destroy(&console->written);
+    pthread_cond_destroy(&console->wake);
+    pthread_mutex_destroy(&console->lock);
+    free(console);
+}
+
+// Makes everything added so far due, and waits for the writer to get to it if untilWritten is set
+// Otherwise waits for a single batch, which is enough to make room once the buffer is full
+static void waitForWriter(consoleOutput * const console, const bool untilWritten) {
+    const uint32_t tail = atomic_load_explicit(&console->tail, memory_order_relaxed);
+    atomic_store(&console->flushTo, tail);
+
+    pthread_mutex_lock(&console->lock);
+    pthread_cond_signal(&console->wake);
+    const uint32_t head = atomic_load_explicit(&console->head, memory_order_acquire);
+    if (head != tail) {
+        if (untilWritten) {
+            while (atomic_load_explicit(&console->head, memory_order_acquire) != tail) pthread_cond_wait(&console->written, &console->lock);
+        } else {
+            while (atomic_load_explicit(&console->head, memory_order_acquire) == head) pthread_cond_wait(&console->written, &console->lock);
+        }
+    }
+    pthread_mutex_unlock(&console->lock);
+}
+
+void putConsole(consoleOutput * const console, const uint8_t byte) {
+    const uint32_t tail = atomic_load_explicit(&console->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&console->head, memory_order_acquire);
+    if (tail - head == CONSOLE_BUFFER_SIZE) {
+        if (!console->block) {
+            atomic_fetch_add_explicit(&console->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        waitForWriter(console, false);
+        head = atomic_load_explicit(&console->head, memory_order_acquire);
+    }
+
+    console->buffer[tail % CONSOLE_BUFFER_SIZE] = byte;
+    atomic_store_explicit(&console->tail, tail + 1, memory_order_release);
+
+    // An idle writer has no timer running, so the first byte wakes it to start one
+    // The fence keeps the idle flag from being read before the byte is added, as the writer reads them the other way round
+    if (console->policy == FLUSH_TIME) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&console->idle)) {
+            pthread_mutex_lock(&console->lock);
+            pthread_cond_signal(&console->wake);
+            pthread_mutex_unlock(&console->lock);
+        }
+    }
+
+    const uint32_t waiting = tail + 1 - head;
+    const bool due = waiting >= CONSOLE_BUFFER_SIZE / 2
+        || (console->policy == FLUSH_NEWLINE && byte == '\n')
+        || (console->policy == FLUSH_SIZE && waiting >= console->flushSize);
+    if (!due) return;
+
+    // An awake writer looks at flushTo again before sleeping, so only a sleeping one needs waking
+    atomic_store(&console->flushTo, tail + 1);
+    if (atomic_load(&console->sleeping)) {
+        pthread_mutex_lock(&console->lock);
+        pthread_cond_signal(&console->wake);
+        pthread_mutex_unlock(&console->lock);
+    }
+}
+
+void printConsole(consoleOutput * const console, const char * const format, ...) {
+    char text[MAX_FORMATTED];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    for (int i = 0; i < length && i < MAX_FORMATTED - 1; i++) putConsole(console, text[i]);
+}
+
+void flushConsole(consoleOutput * const console) {
+    waitForWriter(console, true);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// When buffered output is written out, it's always written out when the buffer is half full or the console is flushed
+typedef enum {
+    FLUSH_NEWLINE, // At the end of each line
+    FLUSH_SIZE, // Once a set number of bytes are waiting
+    FLUSH_TIME // Every set number of milliseconds
+} flushPolicy;
+
+#define DEFAULT_FLUSH_SIZE 4096
+#define DEFAULT_FLUSH_TIME 20
+
+// Console output, buffered on the CPU thread and written out by a thread of its own
+// Single producer single consumer, so the CPU thread only takes a lock to wake the writer or wait for room
+typedef struct consoleOutput consoleOutput;
+
+// amount is the number of bytes for FLUSH_SIZE, or milliseconds for FLUSH_TIME, and is ignored for FLUSH_NEWLINE
+// When the buffer is full, blocking waits for the writer to make room, otherwise the output is dropped and counted
+consoleOutput* createConsole(FILE* file, flushPolicy policy, uint32_t amount, bool block);
+
+// Writes out everything buffered before stopping the writer
+void destroyConsole(consoleOutput* console);
+
+// CPU thread only
+void putConsole(consoleOutput* console, uint8_t byte);
+void printConsole(consoleOutput* console, const char* format, ...);
+
+// Waits until everything buffered has been written out, so other output on the same file comes after it
+void flushConsole(consoleOutput* console);
\ No newline at end of file
@@ -2,26 +2,33 @@
 #include <stdlib.h>
 #include <GLEW/glew.h>
 #include <GLFW/glfw3.h>
+#include "emulate.h"
 #include "display.h"
 
+// The screen is drawn as one quad covering the window,
+// textured with video memory uploaded once per frame as one byte per pixel.
+// The fragment shader turns each RRRGGGBB byte into a colour.
+
+// Video memory starts at the top left, so the texture is flipped vertically
 static const char * const vShaderSource = "\
 #version 330 core\n\
-layout(location = 0) in vec4 vertexPositions;\n\
-uniform vec2 uPosition;\n\
+layout(location = 0) in vec2 vertexPositions;\n\
+out vec2 textureCoords;\n\
 void main() {\n\
-gl_Position = vertexPositions + vec4(uPosition.x / 32, uPosition.y / -32, 0, 0);\n\
+gl_Position = vec4(vertexPositions, 0, 1);\n\
+textureCoords = vec2(vertexPositions.x + 1, 1 - vertexPositions.y) / 2;\n\
 }";
 
 static const char * const fShaderSource = "\
 #version 330 core\n\
+in vec2 textureCoords;\n\
 layout(location = 0) out vec4 colour;\n\
-uniform vec4 uColour;\n\
+uniform sampler2D uScreen;\n\
 void main() {\n\
-colour = uColour;\n\
+uint pixel = uint(texture(uScreen, textureCoords).r * 255 + 0.5);\n\
+colour = vec4(float(pixel >> 5) / 7, float((pixel >> 2) & 7u) / 7, float(pixel & 3u) / 3, 1);\n\
 }";
 
-int colourUniform;
-int positionUniform;
 GLFWwindow* window;
 
 static unsigned int compileShader(const char * const string, const unsigned int type) {
@@ -119,24 +126,24 @@ void initDisplay(void) {
 
     // Setup array buffer
 
-    const float tileVertices[] = {
-        -1.0f,          31.0f / 32.0f,
-        -31.0f / 32.0f, 31.0f / 32.0f,
-        -31.0f / 32.0f, 1.0f,
-        -1.0f,          1.0f
+    const float screenVertices[] = {
+        -1.0f, -1.0f,
+         1.0f, -1.0f,
+         1.0f,  1.0f,
+        -1.0f,  1.0f
     };
 
     unsigned int arrBuf;
     glGenBuffers(1, &arrBuf);
     glBindBuffer(GL_ARRAY_BUFFER, arrBuf);
-    glBufferData(GL_ARRAY_BUFFER, sizeof tileVertices, tileVertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof screenVertices, screenVertices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof (GLfloat), 0);
     glEnableVertexAttribArray(0);
 
     // Setup index buffer
 
-    const uint8_t tileVertexIndices[] = {
+    const uint8_t screenVertexIndices[] = {
         0, 1, 2,
         2, 3, 0
     };
@@ -144,7 +151,25 @@ void initDisplay(void) {
     unsigned int indexBuf;
     glGenBuffers(1, &indexBuf);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof tileVertexIndices, tileVertexIndices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof screenVertexIndices, screenVertexIndices, GL_STATIC_DRAW);
+
+    // Setup screen texture
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // Each pixel is drawn as a solid block, the bytes must reach the shader unchanged
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Starts blank, as frames only upload the rows that changed
+    static const uint8_t blank[FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT] = { 0 };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, blank);
 
     // Setup shaders
 
@@ -152,17 +177,29 @@ void initDisplay(void) {
     glUseProgram(program);
     glDeleteProgram(program); // Mark for deletion once it's no longer being used
 
-    colourUniform = glGetUniformLocation(program, "uColour");
-    if (colourUniform == -1) {
-        printf("Couldn't find uniform uColour\n");
+    const int screenUniform = glGetUniformLocation(program, "uScreen");
+    if (screenUniform == -1) {
+        printf("Couldn't find uniform uScreen\n");
         glfwTerminate();
         exit(1);
     }
+    glUniform1i(screenUniform, 0); // Texture unit 0
+}
 
-    positionUniform = glGetUniformLocation(program, "uPosition");
-    if (positionUniform == -1) {
-        printf("Couldn't find uniform uPosition\n");
-        glfwTerminate();
-        exit(1);
+void drawFramebuffer(const uint8_t * const framebuffer, const uint64_t dirtyRows) {
+    // Each run of dirty rows is uploaded together
+    for (uint32_t row = 0; row < FRAMEBUFFER_HEIGHT;) {
+        if (!(dirtyRows & (1ULL << row))) {
+            row++;
+            continue;
+        }
+
+        uint32_t end = row + 1;
+        while (end < FRAMEBUFFER_HEIGHT && (dirtyRows & (1ULL << end))) end++;
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, FRAMEBUFFER_WIDTH, end - row, GL_RED, GL_UNSIGNED_BYTE, &framebuffer[row * FRAMEBUFFER_WIDTH]);
+        row = end;
     }
+
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
+#include <stdint.h>
 #include <GLFW/glfw3.h>
 
-extern int colourUniform;
-extern int positionUniform;
 extern GLFWwindow* window;
 
-void initDisplay(void);
\ No newline at end of file
+void initDisplay(void);
+
+// Draws the whole screen from a FRAMEBUFFER_WIDTH by FRAMEBUFFER_HEIGHT block of video memory
+// Only the rows set in dirtyRows are uploaded, the rest are kept from earlier frames
+// framebuffer can be NULL if dirtyRows is 0, to draw the last frame again
+void drawFramebuffer(const uint8_t* framebuffer, uint64_t dirtyRows);
\ No newline at end of file
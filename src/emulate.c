@@ -2,1248 +2,519 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <pthread.h>
+#include <string.h>
 #include "emulate.h"
 #include "instructions.h"
-#include "display.h"
-
-uint8_t mem[0x10000];
-uint16_t PC;
-static uint16_t prevPC;
-uint8_t SP = 0xff; // Grows down
-uint8_t AC = 0;
-uint8_t X = 0;
-uint8_t Y = 0;
-
-bool negativeFlag = false;
-bool overflowFlag = false;
-bool decimalFlag = false;
-bool interruptFlag = false;
-bool zeroFlag = false;
-bool carryFlag = false;
+#include "console.h"
+#include "governor.h"
+#include "framebuffer.h"
+#include "interrupts.h"
+#include "scheduler.h"
+#ifdef JIT
+#include "jit.h"
+#endif
+
+#define CONSOLE_REGISTER 0xfffa
+#define DELAY_REGISTER 0xfffb
+
+static void writeConsole(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    if (cpu->console) putConsole(cpu->console, byte);
+}
+
+static void writeDelay(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    delayMilliseconds(cpu, byte);
+}
+
+cpu6502* createCpu(void) {
+    initInstructions();
+
+    cpu6502 * const cpu = calloc(1, sizeof(cpu6502));
+    uint8_t * const mem = calloc(0x10000, 1);
+    if (!cpu || !mem) {
+        printf("Failed to allocate memory for the CPU\n");
+        exit(1);
+    }
+
+    cpu->mem = mem;
+    cpu->SP = 0xff;
+    setStatus(cpu, 0);
+    cpu->clockRate = DEFAULT_CLOCK_RATE;
+    cpu->cycleLimit = UINT64_MAX;
+    cpu->dirtyRows = ~0ULL; // Memory is written directly when a file is loaded
+
+    mapDevice(cpu, CONSOLE_REGISTER, CONSOLE_REGISTER, NULL, &writeConsole);
+    mapDevice(cpu, DELAY_REGISTER, DELAY_REGISTER, NULL, &writeDelay);
+    mapInterrupts(cpu);
+    mapFrameCounter(cpu);
+    resetInterrupts(cpu);
+    return cpu;
+}
+
+void destroyCpu(cpu6502 * const cpu) {
+    #ifdef JIT
+    destroyJit(cpu);
+    #endif
+    free(cpu->mem);
+    free(cpu);
+}
+
+// Memory mapped devices
+
+void mapDevice(cpu6502 * const cpu, const uint16_t first, const uint16_t last, const deviceRead read, const deviceWrite write) {
+    if (first < 0x200 || last < first) {
+        printf("Devices can't be mapped to 0x%.4x - 0x%.4x\n", first, last);
+        exit(1);
+    }
+    if (cpu->deviceCount == MAX_DEVICES) {
+        printf("Too many devices, at most %d can be mapped\n", MAX_DEVICES);
+        exit(1);
+    }
+
+    cpu->devices[cpu->deviceCount++] = (memoryDevice){ .first = first, .last = last, .read = read, .write = write };
+    const uint8_t access = (read ? PAGE_READ : 0) | (write ? PAGE_WRITE : 0);
+    for (uint32_t page = first >> 8; page <= (uint32_t)(last >> 8); page++) cpu->pages[page] |= access;
+}
+
+bool isDevice(const cpu6502 * const cpu, const uint16_t pointer, const uint8_t access) {
+    if (!(cpu->pages[pointer >> 8] & access)) return false;
+
+    for (uint32_t i = 0; i < cpu->deviceCount; i++) {
+        const memoryDevice * const device = &cpu->devices[i];
+        if (pointer < device->first || pointer > device->last) continue;
+        if (((access & PAGE_READ) && device->read) || ((access & PAGE_WRITE) && device->write)) return true;
+    }
+    return false;
+}
+
+uint8_t readDevice(cpu6502 * const cpu, const uint16_t pointer) {
+    // The first device mapped to an address answers reads from it
+    for (uint32_t i = 0; i < cpu->deviceCount; i++) {
+        const memoryDevice * const device = &cpu->devices[i];
+        if (device->read && pointer >= device->first && pointer <= device->last) return device->read(cpu, pointer);
+    }
+    return cpu->mem[pointer];
+}
+
+void writeDevice(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    // Every device mapped to an address sees writes to it
+    for (uint32_t i = 0; i < cpu->deviceCount; i++) {
+        const memoryDevice * const device = &cpu->devices[i];
+        if (device->write && pointer >= device->first && pointer <= device->last) device->write(cpu, pointer, byte);
+    }
+}
+
+// Predecode cache
+
+static const uint8_t opcodeLengths[0x100] = {
+    #define OPCODE(op, ins, mode, cycles, page) [op] = LENGTH_##mode,
+    #include "opcodes.h"
+};
+
+static void decodeInstruction(cpu6502 * const cpu, const uint16_t address) {
+    decodedInstruction * const instruction = &cpu->decodeCache[address];
+    instruction->opcode = cpu->mem[address];
+    instruction->length = opcodeLengths[instruction->opcode];
+
+    switch (instruction->length) {
+        case 1: instruction->operand = 0; break;
+        case 2: instruction->operand = cpu->mem[(uint16_t)(address + 1)]; break;
+        case 3: instruction->operand = readWord(cpu, (uint16_t)(address + 1)); break;
+    }
+
+    for (uint8_t i = 0; i < instruction->length; i++) {
+        const uint16_t byte = address + i;
+        cpu->codeBitmap[byte >> 3] |= 1 << (byte & 7);
+    }
+}
+
+void invalidateCode(cpu6502 * const cpu, const uint16_t pointer) {
+    // Instructions are at most 3 bytes long,
+    // so only the instructions starting at the 2 previous bytes can overlap this one
+    for (uint8_t i = 0; i < 3; i++) {
+        decodedInstruction * const instruction = &cpu->decodeCache[(uint16_t)(pointer - i)];
+        if (instruction->length > i) instruction->length = 0;
+    }
+
+    #ifdef JIT
+    if (cpu->jit) invalidateJit(cpu, pointer);
+    #endif
+
+    cpu->codeBitmap[pointer >> 3] &= ~(1 << (pointer & 7));
+}
+
+void resetCpu(cpu6502 * const cpu, const uint8_t * const image) {
+    memcpy(cpu->mem, image, 0x10000);
+    cpu->dirtyRows = ~0ULL;
+    memset(cpu->writtenPages, 1, sizeof cpu->writtenPages);
+
+    // An instruction's first byte stays marked in the bitmap until it's invalidated,
+    // so only the marked addresses can have a decoded instruction to throw away
+    for (uint32_t i = 0; i < 0x10000 / 8; i++) {
+        if (!cpu->codeBitmap[i]) continue;
+        for (uint32_t bit = 0; bit < 8; bit++) cpu->decodeCache[i * 8 + bit].length = 0;
+        cpu->codeBitmap[i] = 0;
+    }
+
+    #ifdef JIT
+    if (cpu->jit) resetJit(cpu);
+    #endif
+
+    cpu->cycles = 0;
+    cpu->PC = readWord(cpu, 0xfffc);
+    cpu->SP = 0xff;
+    cpu->AC = 0;
+    cpu->X = 0;
+    cpu->Y = 0;
+    setStatus(cpu, 0);
+    cpu->halted = false;
+    cpu->manualPresent = false;
+    cancelEvents(cpu);
+    resetInterrupts(cpu);
+}
+
+static inline const decodedInstruction* fetchInstruction(cpu6502 * const cpu) {
+    const decodedInstruction * const instruction = &cpu->decodeCache[cpu->PC];
+    if (instruction->length == 0) decodeInstruction(cpu, cpu->PC);
+    return instruction;
+}
 
 // Functions for getting the value's address in different addressing modes
-// These should also increment PC by the number of bytes they read
+// These are called after PC has been moved to the last byte of the instruction
 
-static inline uint16_t readAdrImmediate(void) {
-    return ++PC;
+static inline uint16_t readAdrImmediate(cpu6502 * const cpu) {
+    return cpu->PC;
 }
 
 #define readAdrRel readAdrImmediate
 
-static inline uint16_t readAdrZP(void) {
-    return mem[++PC];
+static inline uint16_t readAdrZP(cpu6502 * const cpu, const uint16_t operand) {
+    (void)cpu;
+    // Zero page operands are only 1 byte
+    // Truncating lets the compiler see the address can't be on a device page
+    return (uint8_t)operand;
+}
+
+static inline uint16_t readAdrZPX(cpu6502 * const cpu, const uint16_t operand) {
+    return (operand + cpu->X) & 0xff;
 }
 
-static inline uint16_t readAdrZPX(void) {
-    return (mem[++PC] + X) & 0xff;
+static inline uint16_t readAdrZPY(cpu6502 * const cpu, const uint16_t operand) {
+    return (operand + cpu->Y) & 0xff;
 }
 
-static inline uint16_t readAdrZPY(void) {
-    return (mem[++PC] + Y) & 0xff;
+static inline uint16_t readAdrAbs(cpu6502 * const cpu, const uint16_t operand) {
+    (void)cpu;
+    return operand;
 }
 
-static inline uint16_t readAdrAbs(void) {
-    PC++; return readWord(PC++);
+// Indexed reads take an extra cycle when the index carries into the high byte
+// page is 1 for the instructions this applies to
+static inline void addPageCycle(cpu6502 * const cpu, const bool page, const uint16_t base, const uint16_t address) {
+    if (page) cpu->cycles += (base ^ address) > 0xff;
 }
 
-static inline uint16_t readAdrAbsX(void) {
-    PC++; return readWord(PC++) + X;
+static inline uint16_t readAdrAbsX(cpu6502 * const cpu, const uint16_t operand, const bool page) {
+    const uint16_t address = operand + cpu->X;
+    addPageCycle(cpu, page, operand, address);
+    return address;
 }
 
-static inline uint16_t readAdrAbsY(void) {
-    PC++; return readWord(PC++) + Y;
+static inline uint16_t readAdrAbsY(cpu6502 * const cpu, const uint16_t operand, const bool page) {
+    const uint16_t address = operand + cpu->Y;
+    addPageCycle(cpu, page, operand, address);
+    return address;
 }
 
-static inline uint16_t readAdrInd(void) {
+static inline uint16_t readAdrInd(cpu6502 * const cpu, const uint16_t indirectVector) {
     // In the original 6502 chips, indirect addressing has a bug
     // where if the indirect vector is xxFF,
     // it will read the high byte from xx00 instead of (xx+1)00
     // This bug is fixed in some later chips, but we will emulate it here
-    PC++;
-    const uint16_t indirectVector = readWord(PC++);
     if ((indirectVector & 0xff) == 0xff) {
-        const uint16_t hi = mem[indirectVector & 0xff00] << 8;
-        const uint8_t lo = mem[indirectVector];
+        const uint16_t hi = cpu->mem[indirectVector & 0xff00] << 8;
+        const uint8_t lo = cpu->mem[indirectVector];
         return hi + lo;
     } else {
-        return readWord(indirectVector);
+        return readWord(cpu, indirectVector);
     }
 }
 
-static inline uint16_t readAdrIndX(void) {
-    return readWord(readAdrZPX());
+static inline uint16_t readAdrIndX(cpu6502 * const cpu, const uint16_t operand) {
+    return readWord(cpu, readAdrZPX(cpu, operand));
 }
 
-static inline uint16_t readAdrIndY(void) {
-    return readWord(mem[++PC]) + Y;
+static inline uint16_t readAdrIndY(cpu6502 * const cpu, const uint16_t operand, const bool page) {
+    const uint16_t base = readWord(cpu, operand);
+    const uint16_t address = base + cpu->Y;
+    addPageCycle(cpu, page, base, address);
+    return address;
 }
 
-void readFile(const char * const fileName) {
-    FILE * const file = fopen(fileName, "rb");
-    if (!file) {
-        printf("Failed to open file: %s\n", fileName);
-        exit(1);
+// Dispatch
+// The handler for each opcode is generated from opcodes.h
+// The backend is chosen at build time by defining one of
+// DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED or DISPATCH_TAILCALL
+
+#if !defined(DISPATCH_SWITCH) && !defined(DISPATCH_TABLE) && !defined(DISPATCH_THREADED) && !defined(DISPATCH_TAILCALL)
+#define DISPATCH_TABLE
+#endif
+
+#if (defined(DISPATCH_THREADED) || defined(DISPATCH_TAILCALL)) && !defined(__GNUC__)
+#error "The threaded and tail call dispatch backends require GCC or Clang"
+#endif
+
+// These expect the CPU to be in a variable called cpu and the decoded operand in a variable called operand
+// PC is first moved to the last byte of the instruction, as the instructions expect
+// The base cycle count is added up front, page crossing and branch cycles are added as they happen
+#define EXECUTE_IMP(ins, page) ins(cpu)
+#define EXECUTE_IMM(ins, page) ins(cpu, readAdrImmediate(cpu))
+#define EXECUTE_REL(ins, page) ins(cpu, readAdrRel(cpu))
+#define EXECUTE_ZP(ins, page) ins(cpu, readAdrZP(cpu, operand))
+#define EXECUTE_ZPX(ins, page) ins(cpu, readAdrZPX(cpu, operand))
+#define EXECUTE_ZPY(ins, page) ins(cpu, readAdrZPY(cpu, operand))
+#define EXECUTE_ABS(ins, page) ins(cpu, readAdrAbs(cpu, operand))
+#define EXECUTE_ABSX(ins, page) ins(cpu, readAdrAbsX(cpu, operand, page))
+#define EXECUTE_ABSY(ins, page) ins(cpu, readAdrAbsY(cpu, operand, page))
+#define EXECUTE_IND(ins, page) ins(cpu, readAdrInd(cpu, operand))
+#define EXECUTE_INDX(ins, page) ins(cpu, readAdrIndX(cpu, operand))
+#define EXECUTE_INDY(ins, page) ins(cpu, readAdrIndY(cpu, operand, page))
+#define EXECUTE(ins, mode, cyc, page) do { cpu->PC += LENGTH_##mode - 1; cpu->cycles += cyc; EXECUTE_##mode(ins, page); } while (0)
+
+// Every backend stops a batch at the deadline, which also covers halting, see scheduler.c
+#define AT_DEADLINE() (cpu->cycles >= cpu->deadline)
+
+#if defined(DISPATCH_SWITCH)
+
+static inline void executeInstruction(cpu6502 * const cpu) {
+    const decodedInstruction * const instruction = fetchInstruction(cpu);
+    const uint16_t operand = instruction->operand;
+
+    switch (instruction->opcode) {
+        #define OPCODE(op, ins, mode, cycles, page) case op: EXECUTE(ins, mode, cycles, page); break;
+        #include "opcodes.h"
+
+        // All possible opcodes covered, don't need default statement
     }
+}
 
-    fseek(file, 0, SEEK_END); // Seek to end of file
-    const long fileSize = ftell(file); // Get file length
-    fseek(file, 0, SEEK_SET); // Seek back to beginning of file
+static uint32_t interpretInstructions(cpu6502 * const cpu, const uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (AT_DEADLINE()) return i;
+        executeInstruction(cpu);
+    }
+    return count;
+}
 
-    if (fileSize != 0x10000) {
-        printf("Expected input file to be 65536 bytes long, got %ld\n", fileSize);
-        exit(1);
+#elif defined(DISPATCH_TABLE)
+
+#define OPCODE(op, ins, mode, cycles, page) static void op_##op(cpu6502 * const cpu, const uint16_t operand) { (void)operand; EXECUTE(ins, mode, cycles, page); }
+#include "opcodes.h"
+
+static void (* const opcodeTable[0x100])(cpu6502* cpu, uint16_t operand) = {
+    #define OPCODE(op, ins, mode, cycles, page) [op] = op_##op,
+    #include "opcodes.h"
+};
+
+static uint32_t interpretInstructions(cpu6502 * const cpu, const uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (AT_DEADLINE()) return i;
+        const decodedInstruction * const instruction = fetchInstruction(cpu);
+        opcodeTable[instruction->opcode](cpu, instruction->operand);
     }
+    return count;
+}
+
+#elif defined(DISPATCH_THREADED)
+
+// Labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+static uint32_t interpretInstructions(cpu6502 * const cpu, const uint32_t count) {
+    static void * const labels[0x100] = {
+        #define OPCODE(op, ins, mode, cycles, page) [op] = &&label_##op,
+        #include "opcodes.h"
+    };
+
+    const decodedInstruction* instruction;
+    uint16_t operand;
+    uint32_t remaining = count;
+
+    #define DISPATCH() \
+        if (remaining == 0 || AT_DEADLINE()) return count - remaining; \
+        remaining--; \
+        instruction = fetchInstruction(cpu); \
+        operand = instruction->operand; \
+        goto *labels[instruction->opcode]
+
+    DISPATCH();
+
+    #define OPCODE(op, ins, mode, cycles, page) label_##op: EXECUTE(ins, mode, cycles, page); DISPATCH();
+    #include "opcodes.h"
+
+    #undef DISPATCH
+}
+
+#pragma GCC diagnostic pop
+
+#else // DISPATCH_TAILCALL
+
+// Each handler runs its instruction then tail calls the handler for the next one
+// A call that isn't turned into a jump grows the stack by a frame per instruction, and a batch can be 0x10000 of them,
+// so the tail call is forced where the compiler can, and otherwise the build needs the sibling call optimisation
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+
+#ifndef MUSTTAIL
+#ifndef __OPTIMIZE__
+#error "The tail call dispatch backend needs optimisations enabled with this compiler, see the makefile"
+#endif
+#define MUSTTAIL
+#endif
+
+// Handlers return the number of instructions left in the batch when they stop
+typedef uint32_t (*tailHandler)(cpu6502* cpu, uint16_t operand, uint32_t count);
+static const tailHandler opcodeTable[0x100];
+
+#define OPCODE(op, ins, mode, cycles, page) \
+    static uint32_t op_##op(cpu6502 * const cpu, const uint16_t operand, uint32_t count) { \
+        (void)operand; \
+        EXECUTE(ins, mode, cycles, page); \
+        if (--count == 0 || AT_DEADLINE()) return count; \
+        const decodedInstruction * const instruction = fetchInstruction(cpu); \
+        MUSTTAIL return opcodeTable[instruction->opcode](cpu, instruction->operand, count); \
+    }
+#include "opcodes.h"
+
+static const tailHandler opcodeTable[0x100] = {
+    #define OPCODE(op, ins, mode, cycles, page) [op] = op_##op,
+    #include "opcodes.h"
+};
+
+static uint32_t interpretInstructions(cpu6502 * const cpu, const uint32_t count) {
+    if (count == 0 || AT_DEADLINE()) return 0;
+    const decodedInstruction * const instruction = fetchInstruction(cpu);
+    return count - opcodeTable[instruction->opcode](cpu, instruction->operand, count);
+}
 
-    for (uint32_t i = 0; i < 0x10000; i++) {
-        const int c = getc(file);
-        if (c == EOF) {
-            printf("Failed to read character %d\n", i);
-            exit(1);
+#endif
+
+#ifdef JIT
+
+static uint32_t runCode(cpu6502 * const cpu, const uint32_t count) {
+    if (!cpu->jit) return interpretInstructions(cpu, count);
+
+    uint32_t ran = 0;
+    while (ran < count && !AT_DEADLINE()) {
+        // No instruction takes more than 8 cycles, so a block given this budget can't run past the deadline
+        // Interrupts are then taken between the same instructions as in the interpreter
+        uint32_t budget = count - ran;
+        const uint64_t untilDeadline = (cpu->deadline - cpu->cycles) / 8;
+        if (untilDeadline < budget) budget = untilDeadline;
+
+        const uint32_t compiled = runJit(cpu, budget);
+        if (compiled) {
+            ran += compiled;
+        } else if (interpretInstructions(cpu, 1)) {
+            ran++;
+        } else {
+            break;
         }
-        mem[i] = c;
     }
+    return ran;
+}
+
+#else
 
-    fclose(file);
+static uint32_t runCode(cpu6502 * const cpu, const uint32_t count) {
+    return interpretInstructions(cpu, count);
 }
 
-void runInstruction(void) {
-    if (PC == prevPC){
-        printf("\nInfinite loop at 0x%.4x\n", PC);
-        pthread_exit(NULL);
+#endif
+
+void runInstruction(cpu6502 * const cpu) {
+    if (AT_DEADLINE() && !cpu->halted) serviceEvents(cpu);
+    interpretInstructions(cpu, 1);
+}
+
+uint32_t runInstructions(cpu6502 * const cpu, const uint32_t count) {
+    // Servicing always moves the deadline past the cycle count unless the CPU has halted or reached its cycle limit
+    uint32_t ran = 0;
+    while (ran < count && !cpu->halted && cpu->cycles < cpu->cycleLimit) {
+        if (AT_DEADLINE()) serviceEvents(cpu);
+        ran += runCode(cpu, count - ran);
     }
-    prevPC = PC;
-
-    switch (mem[PC]) {
-        case 0x00:
-        BRK();
-        break;
-
-        case 0x01:
-        ORA(readAdrIndX());
-        break;
-
-        case 0x02:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x03:
-        // Illegal
-        SLO(readAdrIndX());
-        break;
-
-        case 0x04:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x05:
-        ORA(readAdrZP());
-        break;
-
-        case 0x06:
-        ASL(readAdrZP());
-        break;
-
-        case 0x07:
-        // Illegal
-        SLO(readAdrZP());
-        break;
-
-        case 0x08:
-        PHP();
-        break;
-
-        case 0x09:
-        ORA(readAdrImmediate());
-        break;
-
-        case 0x0a:
-        ASLA();
-        break;
-
-        case 0x0b:
-        // Illegal
-        ANC(readAdrImmediate());
-        break;
-
-        case 0x0c:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0x0d:
-        ORA(readAdrAbs());
-        break;
-
-        case 0x0e:
-        ASL(readAdrAbs());
-        break;
-
-        case 0x0f:
-        // Illegal
-        SLO(readAdrAbs());
-        break;
-
-        case 0x10:
-        BPL(readAdrRel());
-        break;
-
-        case 0x11:
-        ORA(readAdrIndY());
-        break;
-
-        case 0x12:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x13:
-        // Illegal
-        SLO(readAdrIndY());
-        break;
-
-        case 0x14:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x15:
-        ORA(readAdrZPX());
-        break;
-
-        case 0x16:
-        ASL(readAdrZPX());
-        break;
-
-        case 0x17:
-        // Illegal
-        SLO(readAdrZPX());
-        break;
-
-        case 0x18:
-        CLC();
-        break;
-
-        case 0x19:
-        ORA(readAdrAbsY());
-        break;
-
-        case 0x1a:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0x1b:
-        // Illegal
-        SLO(readAdrAbsY());
-        break;
-
-        case 0x1c:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0x1d:
-        ORA(readAdrAbsX());
-        break;
-
-        case 0x1e:
-        ASL(readAdrAbsX());
-        break;
-
-        case 0x1f:
-        // Illegal
-        SLO(readAdrAbsX());
-        break;
-
-        case 0x20:
-        JSR(readAdrAbs());
-        break;
-
-        case 0x21:
-        AND(readAdrIndX());
-        break;
-
-        case 0x22:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x23:
-        // Illegal
-        RLA(readAdrIndX());
-        break;
-
-        case 0x24:
-        BIT(readAdrZP());
-        break;
-
-        case 0x25:
-        AND(readAdrZP());
-        break;
-
-        case 0x26:
-        ROL(readAdrZP());
-        break;
-
-        case 0x27:
-        // Illegal
-        RLA(readAdrZP());
-        break;
-
-        case 0x28:
-        PLP();
-        break;
-
-        case 0x29:
-        AND(readAdrImmediate());
-        break;
-
-        case 0x2a:
-        ROLA();
-        break;
-
-        case 0x2b:
-        // Illegal
-        ANC(readAdrImmediate());
-        break;
-
-        case 0x2c:
-        BIT(readAdrAbs());
-        break;
-
-        case 0x2d:
-        AND(readAdrAbs());
-        break;
-
-        case 0x2e:
-        ROL(readAdrAbs());
-        break;
-
-        case 0x2f:
-        // Illegal
-        RLA(readAdrAbs());
-        break;
-
-        case 0x30:
-        BMI(readAdrRel());
-        break;
-
-        case 0x31:
-        AND(readAdrIndY());
-        break;
-
-        case 0x32:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x33:
-        // Illegal
-        RLA(readAdrIndY());
-        break;
-
-        case 0x34:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x35:
-        AND(readAdrZPX());
-        break;
-
-        case 0x36:
-        ROL(readAdrZPX());
-        break;
-
-        case 0x37:
-        // Illegal
-        RLA(readAdrZPX());
-        break;
-
-        case 0x38:
-        SEC();
-        break;
-
-        case 0x39:
-        AND(readAdrAbsY());
-        break;
-
-        case 0x3a:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0x3b:
-        // Illegal
-        RLA(readAdrAbsY());
-        break;
-
-        case 0x3c:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0x3d:
-        AND(readAdrAbsX());
-        break;
-
-        case 0x3e:
-        ROL(readAdrAbsX());
-        break;
-
-        case 0x3f:
-        // Illegal
-        RLA(readAdrAbsX());
-        break;
-
-        case 0x40:
-        RTI();
-        break;
-
-        case 0x41:
-        EOR(readAdrIndX());
-        break;
-
-        case 0x42:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x43:
-        // Illegal
-        SRE(readAdrIndX());
-        break;
-
-        case 0x44:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x45:
-        EOR(readAdrZP());
-        break;
-
-        case 0x46:
-        LSR(readAdrZP());
-        break;
-
-        case 0x47:
-        // Illegal
-        SRE(readAdrZP());
-        break;
-
-        case 0x48:
-        PHA();
-        break;
-
-        case 0x49:
-        EOR(readAdrImmediate());
-        break;
-
-        case 0x4a:
-        LSRA();
-        break;
-
-        case 0x4b:
-        // Illegal
-        ALR(readAdrImmediate());
-        break;
-
-        case 0x4c:
-        JMP(readAdrAbs());
-        break;
-
-        case 0x4d:
-        EOR(readAdrAbs());
-        break;
-
-        case 0x4e:
-        LSR(readAdrAbs());
-        break;
-
-        case 0x4f:
-        // Illegal
-        SRE(readAdrAbs());
-        break;
-
-        case 0x50:
-        BVC(readAdrRel());
-        break;
-
-        case 0x51:
-        EOR(readAdrIndY());
-        break;
-
-        case 0x52:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x53:
-        // Illegal
-        SRE(readAdrIndY());
-        break;
-
-        case 0x54:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x55:
-        EOR(readAdrZPX());
-        break;
-
-        case 0x56:
-        LSR(readAdrZPX());
-        break;
-
-        case 0x57:
-        // Illegal
-        SRE(readAdrZPX());
-        break;
-
-        case 0x58:
-        CLI();
-        break;
-
-        case 0x59:
-        EOR(readAdrAbsY());
-        break;
-
-        case 0x5a:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0x5b:
-        // Illegal
-        SRE(readAdrAbsY());
-        break;
-
-        case 0x5c:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0x5d:
-        EOR(readAdrAbsX());
-        break;
-
-        case 0x5e:
-        LSR(readAdrAbsX());
-        break;
-
-        case 0x5f:
-        // Illegal
-        SRE(readAdrAbsX());
-        break;
-
-        case 0x60:
-        RTS();
-        break;
-
-        case 0x61:
-        ADC(readAdrIndX());
-        break;
-
-        case 0x62:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x63:
-        // Illegal
-        RRA(readAdrIndX());
-        break;
-
-        case 0x64:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x65:
-        ADC(readAdrZP());
-        break;
-
-        case 0x66:
-        ROR(readAdrZP());
-        break;
-
-        case 0x67:
-        // Illegal
-        RRA(readAdrZP());
-        break;
-
-        case 0x68:
-        PLA();
-        break;
-
-        case 0x69:
-        ADC(readAdrImmediate());
-        break;
-
-        case 0x6a:
-        RORA();
-        break;
-
-        case 0x6b:
-        // Illegal
-        ARR(readAdrImmediate());
-        break;
-
-        case 0x6c:
-        JMP(readAdrInd());
-        break;
-
-        case 0x6d:
-        ADC(readAdrAbs());
-        break;
-
-        case 0x6e:
-        ROR(readAdrAbs());
-        break;
-
-        case 0x6f:
-        // Illegal
-        RRA(readAdrAbs());
-        break;
-
-        case 0x70:
-        BVS(readAdrRel());
-        break;
-
-        case 0x71:
-        ADC(readAdrIndY());
-        break;
-
-        case 0x72:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x73:
-        // Illegal
-        RRA(readAdrIndY());
-        break;
-
-        case 0x74:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x75:
-        ADC(readAdrZPX());
-        break;
-
-        case 0x76:
-        ROR(readAdrZPX());
-        break;
-
-        case 0x77:
-        // Illegal
-        RRA(readAdrZPX());
-        break;
-
-        case 0x78:
-        SEI();
-        break;
-
-        case 0x79:
-        ADC(readAdrAbsY());
-        break;
-
-        case 0x7a:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0x7b:
-        // Illegal
-        RRA(readAdrAbsY());
-        break;
-
-        case 0x7c:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0x7d:
-        ADC(readAdrAbsX());
-        break;
-
-        case 0x7e:
-        ROR(readAdrAbsX());
-        break;
-
-        case 0x7f:
-        // Illegal
-        RRA(readAdrAbsX());
-        break;
-
-        case 0x80:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x81:
-        STA(readAdrIndX());
-        break;
-
-        case 0x82:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x83:
-        // Illegal
-        SAX(readAdrIndX());
-        break;
-
-        case 0x84:
-        STY(readAdrZP());
-        break;
-
-        case 0x85:
-        STA(readAdrZP());
-        break;
-
-        case 0x86:
-        STX(readAdrZP());
-        break;
-
-        case 0x87:
-        // Illegal
-        SAX(readAdrZP());
-        break;
-
-        case 0x88:
-        DEY();
-        break;
-
-        case 0x89:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0x8a:
-        TXA();
-        break;
-
-        case 0x8b:
-        // Illegal
-        ANE(readAdrImmediate());
-        break;
-
-        case 0x8c:
-        STY(readAdrAbs());
-        break;
-
-        case 0x8d:
-        STA(readAdrAbs());
-        break;
-
-        case 0x8e:
-        STX(readAdrAbs());
-        break;
-
-        case 0x8f:
-        // Illegal
-        SAX(readAdrAbs());
-        break;
-
-        case 0x90:
-        BCC(readAdrRel());
-        break;
-
-        case 0x91:
-        STA(readAdrIndY());
-        break;
-
-        case 0x92:
-        // Illegal
-        JAM();
-        break;
-
-        case 0x93:
-        // Illegal
-        SHA(readAdrIndY());
-        break;
-
-        case 0x94:
-        STY(readAdrZPX());
-        break;
-
-        case 0x95:
-        STA(readAdrZPX());
-        break;
-
-        case 0x96:
-        STX(readAdrZPY());
-        break;
-
-        case 0x97:
-        // Illegal
-        SAX(readAdrZPY());
-        break;
-
-        case 0x98:
-        TYA();
-        break;
-
-        case 0x99:
-        STA(readAdrAbsY());
-        break;
-
-        case 0x9a:
-        TXS();
-        break;
-
-        case 0x9b:
-        // Illegal
-        TAS(readAdrAbsY());
-        break;
-
-        case 0x9c:
-        // Illegal
-        SHY(readAdrAbsX());
-        break;
-
-        case 0x9d:
-        STA(readAdrAbsX());
-        break;
-
-        case 0x9e:
-        // Illegal
-        SHX(readAdrAbsY());
-        break;
-
-        case 0x9f:
-        // Illegal
-        SHA(readAdrAbsY());
-        break;
-
-        case 0xa0:
-        LDY(readAdrImmediate());
-        break;
-
-        case 0xa1:
-        LDA(readAdrIndX());
-        break;
-
-        case 0xa2:
-        LDX(readAdrImmediate());
-        break;
-
-        case 0xa3:
-        // Illegal
-        LAX(readAdrIndX());
-        break;
-
-        case 0xa4:
-        LDY(readAdrZP());
-        break;
-
-        case 0xa5:
-        LDA(readAdrZP());
-        break;
-
-        case 0xa6:
-        LDX(readAdrZP());
-        break;
-
-        case 0xa7:
-        // Illegal
-        LAX(readAdrZP());
-        break;
-
-        case 0xa8:
-        TAY();
-        break;
-
-        case 0xa9:
-        LDA(readAdrImmediate());
-        break;
-
-        case 0xaa:
-        TAX();
-        break;
-
-        case 0xab:
-        // Illegal
-        LXA(readAdrImmediate());
-        break;
-
-        case 0xac:
-        LDY(readAdrAbs());
-        break;
-
-        case 0xad:
-        LDA(readAdrAbs());
-        break;
-
-        case 0xae:
-        LDX(readAdrAbs());
-        break;
-
-        case 0xaf:
-        // Illegal
-        LAX(readAdrAbs());
-        break;
-
-        case 0xb0:
-        BCS(readAdrRel());
-        break;
-
-        case 0xb1:
-        LDA(readAdrIndY());
-        break;
-
-        case 0xb2:
-        // Illegal
-        JAM();
-        break;
-
-        case 0xb3:
-        // Illegal
-        LAX(readAdrIndY());
-        break;
-
-        case 0xb4:
-        LDY(readAdrZPX());
-        break;
-
-        case 0xb5:
-        LDA(readAdrZPX());
-        break;
-
-        case 0xb6:
-        LDX(readAdrZPY());
-        break;
-
-        case 0xb7:
-        // Illegal
-        LAX(readAdrZPY());
-        break;
-
-        case 0xb8:
-        CLV();
-        break;
-
-        case 0xb9:
-        LDA(readAdrAbsY());
-        break;
-
-        case 0xba:
-        TSX();
-        break;
-
-        case 0xbb:
-        // Illegal
-        LAS(readAdrAbsY());
-        break;
-
-        case 0xbc:
-        LDY(readAdrAbsX());
-        break;
-
-        case 0xbd:
-        LDA(readAdrAbsX());
-        break;
-
-        case 0xbe:
-        LDX(readAdrAbsY());
-        break;
-
-        case 0xbf:
-        // Illegal
-        LAX(readAdrAbsY());
-        break;
-
-        case 0xc0:
-        CPY(readAdrImmediate());
-        break;
-
-        case 0xc1:
-        CMP(readAdrIndX());
-        break;
-
-        case 0xc2:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0xc3:
-        // Illegal
-        DCP(readAdrIndX());
-        break;
-
-        case 0xc4:
-        CPY(readAdrZP());
-        break;
-
-        case 0xc5:
-        CMP(readAdrZP());
-        break;
-
-        case 0xc6:
-        DEC(readAdrZP());
-        break;
-
-        case 0xc7:
-        // Illegal
-        DCP(readAdrZP());
-        break;
-
-        case 0xc8:
-        INY();
-        break;
-
-        case 0xc9:
-        CMP(readAdrImmediate());
-        break;
-
-        case 0xca:
-        DEX();
-        break;
-
-        case 0xcb:
-        // Illegal
-        SBX(readAdrImmediate());
-        break;
-
-        case 0xcc:
-        CPY(readAdrAbs());
-        break;
-
-        case 0xcd:
-        CMP(readAdrAbs());
-        break;
-
-        case 0xce:
-        DEC(readAdrAbs());
-        break;
-
-        case 0xcf:
-        // Illegal
-        DCP(readAdrAbs());
-        break;
-
-        case 0xd0:
-        BNE(readAdrRel());
-        break;
-
-        case 0xd1:
-        CMP(readAdrIndY());
-        break;
-
-        case 0xd2:
-        // Illegal
-        JAM();
-        break;
-
-        case 0xd3:
-        // Illegal
-        DCP(readAdrIndY());
-        break;
-
-        case 0xd4:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0xd5:
-        CMP(readAdrZPX());
-        break;
-
-        case 0xd6:
-        DEC(readAdrZPX());
-        break;
-
-        case 0xd7:
-        // Illegal
-        DCP(readAdrZPX());
-        break;
-
-        case 0xd8:
-        CLD();
-        break;
-
-        case 0xd9:
-        CMP(readAdrAbsY());
-        break;
-
-        case 0xda:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0xdb:
-        // Illegal
-        DCP(readAdrAbsY());
-        break;
-
-        case 0xdc:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0xdd:
-        CMP(readAdrAbsX());
-        break;
-
-        case 0xde:
-        DEC(readAdrAbsX());
-        break;
-
-        case 0xdf:
-        // Illegal
-        DCP(readAdrAbsX());
-        break;
-
-        case 0xe0:
-        CPX(readAdrImmediate());
-        break;
-
-        case 0xe1:
-        SBC(readAdrIndX());
-        break;
-
-        case 0xe2:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0xe3:
-        // Illegal
-        ISC(readAdrIndX());
-        break;
-
-        case 0xe4:
-        CPX(readAdrZP());
-        break;
-
-        case 0xe5:
-        SBC(readAdrZP());
-        break;
-
-        case 0xe6:
-        INC(readAdrZP());
-        break;
-
-        case 0xe7:
-        // Illegal
-        ISC(readAdrZP());
-        break;
-
-        case 0xe8:
-        INX();
-        break;
-
-        case 0xe9:
-        SBC(readAdrImmediate());
-        break;
-
-        case 0xea:
-        NOP(1);
-        break;
-
-        case 0xeb:
-        // Illegal
-        SBC(readAdrImmediate());
-        break;
-
-        case 0xec:
-        CPX(readAdrAbs());
-        break;
-
-        case 0xed:
-        SBC(readAdrAbs());
-        break;
-
-        case 0xee:
-        INC(readAdrAbs());
-        break;
-
-        case 0xef:
-        // Illegal
-        ISC(readAdrAbs());
-        break;
-
-        case 0xf0:
-        BEQ(readAdrRel());
-        break;
-
-        case 0xf1:
-        SBC(readAdrIndY());
-        break;
-
-        case 0xf2:
-        // Illegal
-        JAM();
-        break;
-
-        case 0xf3:
-        // Illegal
-        ISC(readAdrIndY());
-        break;
-
-        case 0xf4:
-        // Illegal
-        NOP(2);
-        break;
-
-        case 0xf5:
-        SBC(readAdrZPX());
-        break;
-
-        case 0xf6:
-        INC(readAdrZPX());
-        break;
-
-        case 0xf7:
-        // Illegal
-        ISC(readAdrZPX());
-        break;
-
-        case 0xf8:
-        SED();
-        break;
-
-        case 0xf9:
-        SBC(readAdrAbsY());
-        break;
-
-        case 0xfa:
-        // Illegal
-        NOP(1);
-        break;
-
-        case 0xfb:
-        // Illegal
-        ISC(readAdrAbsY());
-        break;
-
-        case 0xfc:
-        // Illegal
-        NOP(3);
-        break;
-
-        case 0xfd:
-        SBC(readAdrAbsX());
-        break;
-
-        case 0xfe:
-        INC(readAdrAbsX());
-        break;
-
-        case 0xff:
-        // Illegal
-        ISC(readAdrAbsX());
-        break;
+    cpu->instructions += ran;
+    return ran;
+}
 
-        // All possible opcodes covered, don't need default statement
+void setCycleLimit(cpu6502 * const cpu, const uint64_t cycles) {
+    cpu->cycleLimit = cycles ? cycles : UINT64_MAX;
+    updateDeadline(cpu);
+}
+
+uint32_t limitInstructions(const cpu6502 * const cpu, uint32_t count, const uint64_t instructions, const uint64_t instructionLimit) {
+    if (cpu->cycles >= cpu->cycleLimit) return 0;
+    if (instructionLimit) {
+        if (instructions >= instructionLimit) return 0;
+        if (instructionLimit - instructions < count) count = instructionLimit - instructions;
     }
+    return count;
+}
+
+uint32_t findIdleLoop(cpu6502 * const cpu, uint32_t count, idleLoop * const loop) {
+    loop->instructions = 0;
+    if (count > MAX_IDLE_LOOP) count = MAX_IDLE_LOOP;
+
+    // Every store marks its page, so the marks are cleared to see if the pass stores anything
+    // The rewind buffer's marks are put back afterwards
+    uint8_t writtenPages[0x100];
+    memcpy(writtenPages, cpu->writtenPages, sizeof writtenPages);
+    memset(cpu->writtenPages, 0, sizeof cpu->writtenPages);
+
+    const uint16_t PC = cpu->PC;
+    const uint8_t SP = cpu->SP, AC = cpu->AC, X = cpu->X, Y = cpu->Y, P = getStatus(cpu);
+    const uint64_t cycles = cpu->cycles;
+
+    // One at a time, so a pass is run by the interpreter and stops as soon as it gets back to the start
+    uint32_t ran = 0;
+    while (ran < count && !cpu->halted) {
+        ran += runInstructions(cpu, 1);
+        if (cpu->PC == PC) break;
+    }
+
+    bool stored = false;
+    for (uint32_t page = 0; page < 0x100; page++) {
+        stored |= cpu->writtenPages[page];
+        cpu->writtenPages[page] |= writtenPages[page];
+    }
+
+    // An interrupt that's due would take the CPU out of the loop
+    if (ran && !stored && !AT_DEADLINE() && cpu->PC == PC && cpu->SP == SP && cpu->AC == AC && cpu->X == X && cpu->Y == Y && getStatus(cpu) == P) {
+        loop->instructions = ran;
+        loop->cycles = cpu->cycles - cycles;
+    }
+    return ran;
+}
+
+uint64_t skipIdleLoop(cpu6502 * const cpu, const idleLoop * const loop, const uint64_t instructions, const uint64_t instructionLimit) {
+    if (!loop->instructions || (!instructionLimit && cpu->deadline == UINT64_MAX)) return 0;
+
+    // Stopping at the deadline means events happen at the same cycle as if every pass had run
+    // Runs stop at the first instruction to reach the deadline, so passes can end right on it
+    uint64_t passes = UINT64_MAX;
+    if (instructionLimit) passes = instructions < instructionLimit ? (instructionLimit - instructions) / loop->instructions : 0;
+    if (cpu->deadline != UINT64_MAX) {
+        const uint64_t cyclePasses = cpu->cycles < cpu->deadline ? (cpu->deadline - cpu->cycles) / loop->cycles : 0;
+        if (cyclePasses < passes) passes = cyclePasses;
+    }
+
+    cpu->instructions += passes * loop->instructions;
+    cpu->cycles += passes * loop->cycles;
+    return passes * loop->instructions;
 }
\ No newline at end of file
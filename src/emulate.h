@@ -1,19 +1,219 @@
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-extern uint8_t mem[];
-extern uint16_t PC;
-extern uint8_t SP; // Grows down
-extern uint8_t AC;
-extern uint8_t X;
-extern uint8_t Y;
-
-extern bool negativeFlag;
-extern bool overflowFlag;
-extern bool decimalFlag;
-extern bool interruptFlag;
-extern bool zeroFlag;
-extern bool carryFlag;
-
-void readFile(const char* fileName);
-void runInstruction(void);
\ No newline at end of file
+typedef struct {
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t length; // 0 if this entry hasn't been decoded
+} decodedInstruction;
+
+// Flags in the status register
+#define FLAG_CARRY 0x01
+#define FLAG_ZERO 0x02
+#define FLAG_INTERRUPT 0x04
+#define FLAG_DECIMAL 0x08
+#define FLAG_BREAK 0x10 // Only exists on the stack
+#define FLAG_UNUSED 0x20 // Always 1 on the stack
+#define FLAG_OVERFLOW 0x40
+#define FLAG_NEGATIVE 0x80
+
+// The screen is memory mapped, one RRRGGGBB byte per pixel, row by row from the top left
+#define FRAMEBUFFER_START 0xe000
+#define FRAMEBUFFER_WIDTH 64
+#define FRAMEBUFFER_HEIGHT 64
+
+struct jitCache;
+struct frameExchange;
+struct keyQueue;
+
+typedef struct cpu6502 cpu6502;
+
+// Memory mapped devices
+// Reads from a device's addresses come from its read handler instead of memory,
+// and writes are stored in memory before its write handler is called
+// Reads shouldn't have side effects, since idle loops are found by reading the same registers again
+typedef uint8_t (*deviceRead)(cpu6502* cpu, uint16_t pointer);
+typedef void (*deviceWrite)(cpu6502* cpu, uint16_t pointer, uint8_t byte);
+
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+    deviceRead read; // NULL if reads come from memory
+    deviceWrite write; // NULL if writes are only stored
+} memoryDevice;
+
+#define MAX_DEVICES 16
+
+// Device events, see scheduler.c
+// A handler is called between instructions once the cycle count reaches the cycle its event was scheduled for
+typedef void (*eventHandler)(cpu6502* cpu, uint64_t cycle);
+
+#define MAX_EVENTS 8
+
+// Page table flags, for each 256 byte page with a device on it
+#define PAGE_READ 0x01
+#define PAGE_WRITE 0x02
+
+// Everything belonging to one emulated machine
+// The registers come first so everything an instruction touches shares a cache line
+struct cpu6502 {
+    uint8_t* mem;
+    uint64_t cycles; // Clock cycles run since starting
+    uint64_t deadline; // Instructions only start below this cycle count, then runInstructions looks for events, see scheduler.c
+    uint64_t cycleLimit; // Runs stop at the first instruction to reach this, UINT64_MAX for no limit, see setCycleLimit
+    uint16_t PC;
+    uint8_t SP; // Grows down
+    uint8_t AC;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t P; // Flags, laid out as in the status register, except N and Z which are kept lazily below
+    uint8_t zeroResult; // Z is set when this is 0
+    uint8_t negativeResult; // N is bit 7 of this
+    bool halted; // Set when the CPU runs a JAM instruction or gets stuck in an infinite loop
+    struct jitCache* jit; // NULL if this CPU isn't using the JIT
+    struct consoleOutput* console; // Where the console output register writes to, NULL to discard it
+    uint64_t clockRate; // Cycles per second the delay register counts in, 0 if delays pass in real time without cycles
+    uint64_t instructions; // Instructions run by runInstructions, input recordings are timed by this
+    uint64_t dirtyRows; // Bit per screen row written since the screen was last presented
+    struct frameExchange* frames; // Where the screen is presented, NULL if nothing displays this CPU
+    bool manualPresent; // Set once the program uses the present register, the screen is then only presented when it asks
+    struct keyQueue* keys; // Key presses waiting for the program, NULL if this CPU has no keyboard
+
+    // Interrupt and timer state, see interrupts.c
+    uint8_t timerEvent;
+    uint8_t frameEvent; // Scheduled once the frame counter is started, see framebuffer.c
+    uint16_t timerPeriod; // Milliseconds
+    uint8_t interruptStatus;
+    uint8_t interruptEnable;
+    bool nmiPending;
+
+    // Pages that are plain memory are 0, so only accesses to pages with a device leave the fast path
+    uint8_t pages[0x100];
+    memoryDevice devices[MAX_DEVICES];
+    uint8_t deviceCount;
+
+    // Device events, see scheduler.c
+    eventHandler eventHandlers[MAX_EVENTS];
+    uint64_t eventCycles[MAX_EVENTS]; // Cycle count each event is scheduled for, UINT64_MAX if it isn't
+    uint8_t eventHeap[MAX_EVENTS]; // Scheduled events, a binary min-heap by cycle count
+    uint8_t eventPositions[MAX_EVENTS]; // Where each scheduled event is in the heap
+    uint8_t eventCount;
+    uint8_t scheduledCount;
+
+    // Nonzero for each page stored to since the rewind buffer last looked, so it only compares pages that may have changed
+    uint8_t writtenPages[0x100];
+
+    // Predecode cache
+    // Each address that has been executed keeps its decoded instruction,
+    // so the opcode and operand don't need to be read from memory every time it runs
+    // codeBitmap marks which bytes are part of a cached instruction so writes to them can invalidate it
+    decodedInstruction decodeCache[0x10000];
+    uint8_t codeBitmap[0x10000 / 8];
+};
+
+// Nearly every instruction sets N and Z, but few of them are ever read
+// So the value they come from is kept, and they're only worked out when something reads them
+static inline uint8_t getStatus(const cpu6502 * const cpu) {
+    return (cpu->P & ~(FLAG_NEGATIVE | FLAG_ZERO)) | (cpu->negativeResult & FLAG_NEGATIVE) | (cpu->zeroResult ? 0 : FLAG_ZERO);
+}
+
+static inline void setStatus(cpu6502 * const cpu, const uint8_t status) {
+    cpu->P = status;
+    cpu->zeroResult = ~status & FLAG_ZERO;
+    cpu->negativeResult = status;
+}
+
+// Stops the CPU, runs end after the current instruction
+static inline void haltCpu(cpu6502 * const cpu) {
+    cpu->halted = true;
+    cpu->deadline = 0;
+}
+
+static inline bool getFlag(const cpu6502 * const cpu, const uint8_t flag) {
+    return getStatus(cpu) & flag;
+}
+
+static inline void setFlag(cpu6502 * const cpu, const uint8_t flag, const bool value) {
+    if (flag & FLAG_ZERO) cpu->zeroResult = !value;
+    if (flag & FLAG_NEGATIVE) cpu->negativeResult = value ? FLAG_NEGATIVE : 0;
+    cpu->P = (cpu->P & ~flag) | (value ? flag : 0);
+}
+
+// Instruction lengths for each addressing mode
+#define LENGTH_IMP 1
+#define LENGTH_IMM 2
+#define LENGTH_REL 2
+#define LENGTH_ZP 2
+#define LENGTH_ZPX 2
+#define LENGTH_ZPY 2
+#define LENGTH_ABS 3
+#define LENGTH_ABSX 3
+#define LENGTH_ABSY 3
+#define LENGTH_IND 3
+#define LENGTH_INDX 2
+#define LENGTH_INDY 2
+
+void invalidateCode(cpu6502* cpu, uint16_t pointer);
+
+// Must be called whenever mem is written to,
+// so cached decodes of self-modifying code are thrown away and the write is tracked
+static inline void checkCodeWrite(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->writtenPages[pointer >> 8] = 1;
+    if (cpu->codeBitmap[pointer >> 3] & (1 << (pointer & 7))) invalidateCode(cpu, pointer);
+}
+
+// Maps a device to the addresses first to last, which can't include the zero page or stack
+// Devices must be mapped before the CPU runs, compiled code assumes the pages it accesses stay as they are
+// The console output, delay, interrupt, timer and frame counter registers are mapped by createCpu
+void mapDevice(cpu6502* cpu, uint16_t first, uint16_t last, deviceRead read, deviceWrite write);
+
+// Whether a device handles the given kind of access, PAGE_READ and/or PAGE_WRITE, to pointer
+bool isDevice(const cpu6502* cpu, uint16_t pointer, uint8_t access);
+
+// Slow paths for pages with a device, called with the byte already stored for writes
+uint8_t readDevice(cpu6502* cpu, uint16_t pointer);
+void writeDevice(cpu6502* cpu, uint16_t pointer, uint8_t byte);
+
+// Allocates a CPU with its own memory, with all registers and memory cleared except SP
+// Console output is discarded until a console is given to it
+cpu6502* createCpu(void);
+void destroyCpu(cpu6502* cpu);
+
+// Copies a 64KiB image into memory and resets the registers, ready to run from the start location
+// Cached code is thrown away, so a CPU can be reused for another program
+void resetCpu(cpu6502* cpu, const uint8_t* image);
+
+void runInstruction(cpu6502* cpu);
+
+// Returns the number of instructions run, which is only less than count if the CPU halted or reached its cycle limit
+// Interrupts are taken between instructions, and aren't counted as instructions
+uint32_t runInstructions(cpu6502* cpu, uint32_t count);
+
+// Sets the cycle count runs stop at, 0 for no limit
+// The limit is part of the deadline, so runs stop at the first instruction to reach it however they're split up
+void setCycleLimit(cpu6502* cpu, uint64_t cycles);
+
+// Shortens a run of count instructions so it stops at the instruction limit, 0 for no limit
+// instructions is how far the CPU has got, and 0 is returned once the instruction limit or the CPU's cycle limit is reached
+uint32_t limitInstructions(const cpu6502* cpu, uint32_t count, uint64_t instructions, uint64_t instructionLimit);
+
+// Idle loops
+// A loop that gets back to where it started with the same registers, without storing anything,
+// does exactly the same on every pass until something outside the CPU changes memory or a device,
+// so passes can be skipped rather than run while the program waits for input
+typedef struct {
+    uint32_t instructions; // Per pass, 0 if the CPU isn't in an idle loop
+    uint32_t cycles; // Per pass
+} idleLoop;
+
+#define MAX_IDLE_LOOP 16 // Most instructions in a loop findIdleLoop can find
+
+// Runs one pass of the loop the CPU is in, if it's in one, and fills in loop
+// At most count instructions are run, and the number run is returned
+uint32_t findIdleLoop(cpu6502* cpu, uint32_t count, idleLoop* loop);
+
+// Skips as many passes of an idle loop as finish within the instruction limit and the CPU's deadline, and returns the instructions skipped
+// The registers and memory stay as they are, only the instruction and cycle counts move on
+// The deadline covers the cycle limit and scheduled events, so nothing is skipped unless there's a limit or an event is coming
+uint64_t skipIdleLoop(cpu6502* cpu, const idleLoop* loop, uint64_t instructions, uint64_t instructionLimit);
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "emulate.h"
+#include "framebuffer.h"
+#include "interrupts.h"
+#include "scheduler.h"
+#include "governor.h"
+
+// Triple buffered frame handoff
+//
+// The emulation thread owns the back buffer and the display thread owns the front buffer.
+// The third buffer is swapped with one of them by a single atomic exchange,
+// so publishing or taking a frame never blocks, and the display always gets the newest whole frame.
+//
+// Each frame also carries the rows that may differ from the last frame the display took,
+// so the display can keep only uploading changed rows even when it misses frames.
+//
+// Frames are otherwise ended by the governor, but a program that counts frames needs them at exact cycle counts,
+// so once it starts the frame counter they're a scheduled event of the CPU's own, see scheduler.c.
+// The screen is then presented as the counter moves on and the vsync interrupt is raised,
+// so a program drawing after vsync never has a half drawn frame shown. Headless and batch runs count frames the same way.
+
+#define FRAMEBUFFER_SIZE (FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT)
+#define FRAME_FRESH 4 // Set alongside the middle buffer's index when it holds a frame the display hasn't taken
+
+struct frameExchange {
+    uint8_t buffers[3][FRAMEBUFFER_SIZE];
+    uint64_t dirtyRows[3];
+    _Atomic uint32_t middle;
+
+    // Emulation thread
+    uint32_t back;
+    uint64_t untakenRows; // Changed since the last frame the display is known to have taken
+
+    // Display thread
+    uint32_t front;
+};
+
+frameExchange* createFrameExchange(void) {
+    // Every buffer starts blank, as does the display's texture
+    frameExchange * const frames = calloc(1, sizeof(frameExchange));
+    if (!frames) {
+        printf("Failed to allocate memory for the frame buffers\n");
+        exit(1);
+    }
+
+    frames->back = 0;
+    atomic_init(&frames->middle, 1);
+    frames->front = 2;
+    return frames;
+}
+
+void destroyFrameExchange(frameExchange * const frames) {
+    free(frames);
+}
+
+const uint8_t* takeFrame(frameExchange * const frames, uint64_t * const dirtyRows) {
+    if (!(atomic_load(&frames->middle) & FRAME_FRESH)) return NULL;
+
+    // Only this thread clears FRAME_FRESH, so the middle buffer still holds a frame
+    const uint32_t middle = atomic_exchange(&frames->middle, frames->front);
+    frames->front = middle & ~FRAME_FRESH;
+
+    *dirtyRows = frames->dirtyRows[frames->front];
+    return frames->buffers[frames->front];
+}
+
+static void publishFrame(frameExchange * const frames, const uint8_t * const framebuffer, const uint64_t dirtyRows) {
+    frames->untakenRows |= dirtyRows;
+    memcpy(frames->buffers[frames->back], framebuffer, FRAMEBUFFER_SIZE);
+    frames->dirtyRows[frames->back] = frames->untakenRows;
+
+    const uint32_t middle = atomic_exchange(&frames->middle, frames->back | FRAME_FRESH);
+    frames->back = middle & ~FRAME_FRESH;
+
+    // If the display took the previous frame, the next one only needs the rows changed after this one
+    // Otherwise that frame was never seen, and its rows carry over
+    if (!(middle & FRAME_FRESH)) frames->untakenRows = dirtyRows;
+}
+
+// Only the rows of the screen that changed are uploaded
+static void writeFramebuffer(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)byte;
+    cpu->dirtyRows |= 1ULL << ((pointer - FRAMEBUFFER_START) / FRAMEBUFFER_WIDTH);
+}
+
+static void writePresent(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    (void)byte;
+    cpu->manualPresent = true;
+    presentFrame(cpu);
+}
+
+void attachFrameExchange(cpu6502 * const cpu, frameExchange * const frames) {
+    cpu->frames = frames;
+    mapDevice(cpu, FRAMEBUFFER_START, FRAMEBUFFER_START + FRAMEBUFFER_SIZE - 1, NULL, &writeFramebuffer);
+    mapDevice(cpu, PRESENT_REGISTER, PRESENT_REGISTER, NULL, &writePresent);
+}
+
+void presentFrame(cpu6502 * const cpu) {
+    if (!cpu->frames) return;
+
+    publishFrame(cpu->frames, &cpu->mem[FRAMEBUFFER_START], cpu->dirtyRows);
+    cpu->dirtyRows = 0;
+}
+
+void endFrame(cpu6502 * const cpu) {
+    // A frame with nothing changed would only have the display draw the same screen again
+    if (!cpu->manualPresent && cpu->dirtyRows) presentFrame(cpu);
+}
+
+// Frames are in emulated time, so with an unlimited clock rate they're counted at the default one
+static uint64_t getFrameCycles(const cpu6502 * const cpu) {
+    const uint64_t rate = cpu->clockRate ? cpu->clockRate : DEFAULT_CLOCK_RATE;
+    const uint64_t cycles = rate / FRAME_RATE;
+    return cycles ? cycles : 1;
+}
+
+// The counter is the byte in memory, which the write has already stored
+static void writeFrameCounter(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    (void)byte;
+    scheduleEvent(cpu, cpu->frameEvent, cpu->cycles + getFrameCycles(cpu));
+}
+
+static void countFrame(cpu6502 * const cpu, const uint64_t cycle) {
+    // A delay can run past several frames, which are all counted but only raise the interrupt once
+    const uint64_t period = getFrameCycles(cpu);
+    const uint64_t frames = (cpu->cycles - cycle) / period + 1;
+    scheduleEvent(cpu, cpu->frameEvent, cycle + frames * period);
+
+    cpu->mem[FRAME_COUNTER] += frames;
+    checkCodeWrite(cpu, FRAME_COUNTER);
+    endFrame(cpu);
+    raiseInterrupt(cpu, INTERRUPT_VSYNC);
+}
+
+void mapFrameCounter(cpu6502 * const cpu) {
+    mapDevice(cpu, FRAME_COUNTER, FRAME_COUNTER, NULL, &writeFrameCounter);
+    cpu->frameEvent = addEvent(cpu, &countFrame);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include <stdint.h>
+
+#define PRESENT_REGISTER 0xfff0 // Writing any value publishes the screen, and stops it being published every frame
+#define FRAME_COUNTER 0xfff1 // Counts up at the end of every frame, once writing it has started it from the value written
+
+// Copies of video memory passed from the emulation thread to the display thread
+// Triple buffered, so neither thread waits for the other and the display only ever sees whole frames
+typedef struct frameExchange frameExchange;
+
+frameExchange* createFrameExchange(void);
+void destroyFrameExchange(frameExchange* frames);
+
+// Has the CPU's screen presented to frames, mapping video memory and the present register
+void attachFrameExchange(cpu6502* cpu, frameExchange* frames);
+
+// Display thread only
+// Returns the newest frame published since the last call, or NULL if there isn't one
+// The frame stays valid until the next call, and dirtyRows is set to the rows that may have changed since the last frame
+const uint8_t* takeFrame(frameExchange* frames, uint64_t* dirtyRows);
+
+// Emulation thread only
+// Publishes the CPU's video memory as the newest frame, if anything is displaying the CPU
+void presentFrame(cpu6502* cpu);
+
+// Called at the end of each emulated frame
+// Presents the screen if it changed, unless the program presents its own frames through the present register
+void endFrame(cpu6502* cpu);
+
+// Maps the frame counter, called by createCpu
+// Once it's started, frames are ended by the CPU's own frame event, which also raises the vsync interrupt
+void mapFrameCounter(cpu6502* cpu);
\ No newline at end of file
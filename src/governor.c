@@ -0,0 +1,283 @@
+#define _POSIX_C_SOURCE 200809L // For clock_nanosleep
+#define _WIN32_WINNT 0x0600 // For CreateWaitableTimerExW
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "emulate.h"
+#include "governor.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+// Runs the CPU at a set clock rate
+//
+// The CPU runs in slices of a couple of milliseconds worth of cycles,
+// then the thread sleeps until real time catches up with the emulated clock.
+// Timing comes from the cycle count, so the delay register adds cycles and waits for them
+//
+// Frames are counted in emulated time too, so a program sees the same number of cycles per frame
+// however fast the host is. When the clock rate is unlimited, frames follow real time instead.
+//
+// A CPU in an idle loop, waiting for a key, is parked on a condition variable rather than run.
+// When it's woken, the passes it would have run in the meantime are skipped in one go,
+// so the cycle count still follows real time and a recording still counts every instruction.
+// While the timer is running it's only parked until the timer is due, or skips straight to it at an unlimited clock rate.
+
+#define SLICE_NS 2000000 // Real time per slice
+#define MAX_LAG_NS 100000000 // If the emulator falls further behind than this it stops trying to catch up
+#define NS_PER_SECOND 1000000000ULL
+#define UNLIMITED_BATCH 1000 // Instructions per slice when the clock rate is unlimited
+
+#ifdef _WIN32
+// Only defined in newer SDKs, needs Windows 10 1803 or later
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x2
+#endif
+
+static HANDLE timer;
+static LARGE_INTEGER frequency;
+#endif
+
+static cpu6502* cpu;
+static uint64_t clockRate;
+static uint64_t sliceCycles;
+static atomic_bool stopped;
+
+// Set by wakeGovernor, and cleared once a parked CPU thread has woken
+// Wakes that come while the CPU is running are kept, so the next park returns straight away
+static pthread_mutex_t parkLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t parkCondition = PTHREAD_COND_INITIALIZER;
+static bool woken;
+
+// The cycle count, or time when the clock rate is unlimited, the next frame ends at
+static uint64_t nextFrame;
+static uint64_t frameLength;
+
+// baseCycles is due to be reached at baseTime
+static uint64_t baseTime;
+static uint64_t baseCycles;
+
+// Monotonic time in nanoseconds
+static uint64_t getTime(void) {
+    #ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    const uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    const uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * NS_PER_SECOND + remainder * NS_PER_SECOND / frequency.QuadPart;
+    #else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+    #endif
+}
+
+static void sleepUntil(const uint64_t time) {
+    if (atomic_load(&stopped)) return;
+
+    #ifdef _WIN32
+    const uint64_t now = getTime();
+    if (time <= now) return;
+
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)((time - now) / 100); // Negative for a relative time, in 100ns units
+    SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE);
+    WaitForSingleObject(timer, INFINITE);
+    #else
+    const struct timespec deadline = { .tv_sec = time / NS_PER_SECOND, .tv_nsec = time % NS_PER_SECOND };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+    #endif
+}
+
+void initGovernor(cpu6502 * const governedCpu, const uint64_t rate) {
+    cpu = governedCpu;
+    cpu->clockRate = rate;
+    clockRate = rate;
+    sliceCycles = rate * SLICE_NS / NS_PER_SECOND;
+    if (sliceCycles == 0) sliceCycles = 1;
+
+    #ifdef _WIN32
+    QueryPerformanceFrequency(&frequency);
+
+    // Normal waitable timers are only accurate to the system timer resolution, usually 15.6ms
+    timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer) timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    if (!timer) {
+        printf("Failed to create timer\n");
+        exit(1);
+    }
+    #endif
+
+    frameLength = rate ? rate / FRAME_RATE : NS_PER_SECOND / FRAME_RATE;
+    if (frameLength == 0) frameLength = 1;
+    resyncGovernor();
+}
+
+void resyncGovernor(void) {
+    baseTime = getTime();
+    baseCycles = cpu->cycles;
+    nextFrame = (clockRate ? cpu->cycles : baseTime) + frameLength;
+}
+
+// The real time a cycle count, the current one or later, should be reached at
+static uint64_t getCycleTime(const uint64_t cycles) {
+    // Move the base forward every emulated second so the multiplication below can't overflow
+    while (cpu->cycles - baseCycles >= clockRate) {
+        baseCycles += clockRate;
+        baseTime += NS_PER_SECOND;
+    }
+
+    const uint64_t elapsed = cycles - baseCycles;
+    return baseTime + elapsed / clockRate * NS_PER_SECOND + elapsed % clockRate * NS_PER_SECOND / clockRate;
+}
+
+// The real time the current cycle count should be reached at
+static uint64_t getDueTime(void) {
+    return getCycleTime(cpu->cycles);
+}
+
+// Runs instructions until at least count cycles have passed
+static void runCycles(const uint64_t count) {
+    const uint64_t target = cpu->cycles + count;
+    while (cpu->cycles < target && !cpu->halted) {
+        // No instruction takes more than 8 cycles, so this overshoots by at most 1 instruction
+        runInstructions(cpu, (target - cpu->cycles) / 8 + 1);
+    }
+}
+
+// Ends the frame once the slice has run past it
+// A slice is shorter than a frame unless the clock rate is very low, and then frames can't all be shown anyway
+static void checkFrame(const uint64_t now) {
+    if (now < nextFrame) return;
+
+    nextFrame += frameLength;
+    if (nextFrame <= now) nextFrame = now + frameLength; // Fell behind, e.g. after a long delay
+
+    // Once the program counts frames, they end as its frame counter moves on instead, see framebuffer.c
+    if (getEventCycle(cpu, cpu->frameEvent) == UINT64_MAX) endFrame(cpu);
+}
+
+// Sleeps until woken, or until the given time if it isn't 0
+static void parkUntil(const uint64_t time) {
+    // Condition variables time out by the wall clock, so the wait is converted to it
+    struct timespec deadline = { 0 };
+    if (time) {
+        const uint64_t now = getTime();
+        const uint64_t wait = time > now ? time - now : 0;
+        timespec_get(&deadline, TIME_UTC);
+        deadline.tv_sec += wait / NS_PER_SECOND;
+        deadline.tv_nsec += wait % NS_PER_SECOND;
+        deadline.tv_sec += deadline.tv_nsec / NS_PER_SECOND;
+        deadline.tv_nsec %= NS_PER_SECOND;
+    }
+
+    pthread_mutex_lock(&parkLock);
+    bool timedOut = false;
+    while (!woken && !timedOut && !atomic_load(&stopped)) {
+        if (time) {
+            timedOut = pthread_cond_timedwait(&parkCondition, &parkLock, &deadline) == ETIMEDOUT;
+        } else {
+            pthread_cond_wait(&parkCondition, &parkLock);
+        }
+    }
+    woken = false;
+    pthread_mutex_unlock(&parkLock);
+}
+
+void parkGovernor(void) {
+    parkUntil(0);
+}
+
+void wakeGovernor(void) {
+    pthread_mutex_lock(&parkLock);
+    woken = true;
+    pthread_cond_signal(&parkCondition);
+    pthread_mutex_unlock(&parkLock);
+}
+
+// Parks the CPU if it's in an idle loop, returning whether it was
+static bool parkIdle(void) {
+    idleLoop loop;
+    findIdleLoop(cpu, MAX_IDLE_LOOP, &loop);
+    if (!loop.instructions) return false;
+
+    // The deadline is when the timer is next due, as nothing else is waiting in an idle loop
+    const bool timed = cpu->deadline != UINT64_MAX;
+    if (timed && clockRate == 0) {
+        skipIdleLoop(cpu, &loop, 0, 0);
+        return true;
+    }
+
+    const uint64_t parkTime = getTime();
+    if (timed) {
+        parkUntil(getCycleTime(cpu->deadline));
+    } else {
+        endFrame(cpu); // Show what was drawn before the program started waiting
+        parkGovernor();
+    }
+
+    // With an unlimited clock rate there's no telling how many passes would have run, so none are
+    if (clockRate != 0) {
+        const uint64_t parked = getTime() - parkTime;
+        const uint64_t cycles = parked / NS_PER_SECOND * clockRate + parked % NS_PER_SECOND * clockRate / NS_PER_SECOND;
+        // Windowed runs have no cycle limit of their own, so the time spent parked is used as one
+        setCycleLimit(cpu, cpu->cycles + cycles);
+        skipIdleLoop(cpu, &loop, 0, 0);
+        setCycleLimit(cpu, 0);
+    }
+    resyncGovernor();
+    return true;
+}
+
+void runSlice(void) {
+    if (clockRate == 0) {
+        runInstructions(cpu, UNLIMITED_BATCH);
+        checkFrame(getTime());
+        parkIdle();
+        return;
+    }
+
+    runCycles(sliceCycles);
+    checkFrame(cpu->cycles);
+    if (parkIdle()) return;
+
+    const uint64_t dueTime = getDueTime();
+    const uint64_t now = getTime();
+
+    if (now > dueTime + MAX_LAG_NS) {
+        // The host can't keep up, or the thread was held up
+        // Carry on from here rather than running flat out to catch up
+        baseTime = now;
+        baseCycles = cpu->cycles;
+    } else {
+        sleepUntil(dueTime);
+    }
+}
+
+void delayMilliseconds(cpu6502 * const delayedCpu, const uint8_t milliseconds) {
+    // The cycles are counted the same whether or not the CPU is governed, so a replay takes the same path as the run it recorded
+    delayedCpu->cycles += milliseconds * delayedCpu->clockRate / 1000;
+
+    // CPUs that aren't governed only count the cycles
+    if (delayedCpu != cpu) return;
+
+    if (clockRate != 0) {
+        // Sleep straight away rather than at the end of the slice,
+        // otherwise a loop of delays would all run before the first sleep
+        sleepUntil(getDueTime());
+    } else {
+        sleepUntil(getTime() + milliseconds * (NS_PER_SECOND / 1000));
+    }
+}
+
+void stopGovernor(void) {
+    atomic_store(&stopped, true);
+    wakeGovernor();
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include <stdint.h>
+
+#define DEFAULT_CLOCK_RATE 1000000 // 1 MHz
+#define MAX_CLOCK_RATE 10000000000 // 10 GHz, higher rates would overflow the timing calculations
+#define FRAME_RATE 60 // Frames per second of emulated time
+
+// Sets the CPU to run and its clock rate in Hz, 0 runs as fast as possible
+void initGovernor(cpu6502* cpu, uint64_t rate);
+
+// Runs a slice of emulation, then sleeps until the emulated clock has caught up with real time
+// If the CPU is in an idle loop it's parked instead, see parkGovernor
+void runSlice(void);
+
+// Sleeps until wakeGovernor or stopGovernor is called, for while the CPU is halted
+void parkGovernor(void);
+
+// Wakes the CPU thread if it's parked, for anything that could change what an idle or halted CPU does
+// Called from other threads, e.g. after pushing a key
+void wakeGovernor(void);
+
+// Times the CPU from its current cycle count again, after it has gone back in time
+void resyncGovernor(void);
+
+// Waits for the given number of milliseconds of emulated time, used by the 0xFFFB delay register
+// CPUs other than the governed one only have the cycles added, at their own clockRate
+void delayMilliseconds(cpu6502* cpu, uint8_t milliseconds);
+
+// Stops the governor sleeping, so the emulation thread can finish quickly once the window closes
+void stopGovernor(void);
\ No newline at end of file
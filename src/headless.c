@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "emulate.h"
+#include "governor.h"
+#include "rewind.h"
+#include "keyboard.h"
+#include "console.h"
+#include "headless.h"
+
+// Runs a program without a window, for machines with no display
+// Nothing here uses GLFW or GLEW, so headless builds don't need them
+
+#define HEADLESS_SLICE 0x10000 // Most instructions run between limit checks
+
+// Writes a binary PPM with the same RRRGGGBB colours the window shows
+static void dumpFramebuffer(const cpu6502 * const cpu, const char * const fileName) {
+    FILE * const file = fopen(fileName, "wb");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
+    for (uint16_t i = 0; i < FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT; i++) {
+        const uint8_t byte = cpu->mem[FRAMEBUFFER_START + i];
+        putc(((byte & 0xe0) >> 5) * 255 / 7, file);
+        putc(((byte & 0x1c) >> 2) * 255 / 7, file);
+        putc((byte & 0x03) * 255 / 3, file);
+    }
+
+    if (fclose(file) != 0) {
+        printf("Failed to write file: %s\n", fileName);
+        exit(1);
+    }
+}
+
+// Shortens a run of count instructions to stop at the limits, and at the next replayed key so it's shown at the right point
+static uint32_t limitRun(const cpu6502 * const cpu, const uint32_t count, const uint64_t instructions, const uint64_t instructionLimit) {
+    const uint32_t limited = limitInstructions(cpu, count, instructions, instructionLimit);
+    const uint64_t untilKey = untilReplayKey(cpu);
+    return untilKey && untilKey < limited ? untilKey : limited;
+}
+
+void runHeadless(cpu6502 * const cpu, const uint64_t instructionLimit, const uint64_t cycleLimit, const uint64_t rewindCycles, const char * const dumpName) {
+    // History is only kept when it's going to be used
+    // Entries are as far apart as they would be running at the default clock rate
+    rewindBuffer * const history = rewindCycles ? createRewind(DEFAULT_CLOCK_RATE / REWIND_RATE, REWIND_MEMORY) : NULL;
+
+    setCycleLimit(cpu, cycleLimit);
+
+    // Replayed keys are shown between the same instructions they were recorded between
+    deliverKeys(cpu);
+
+    uint64_t instructions = 0;
+    bool waiting = false; // Set if the program is waiting for a key that isn't coming
+    while (!cpu->halted) {
+        if (history) recordRewind(history, cpu);
+
+        const uint32_t count = limitRun(cpu, HEADLESS_SLICE, instructions, instructionLimit);
+        if (!count) break;
+        instructions += runInstructions(cpu, count);
+        deliverKeys(cpu);
+
+        // Only a key or the timer can change what an idle loop does, so the passes before the next one are skipped
+        idleLoop loop;
+        instructions += findIdleLoop(cpu, limitRun(cpu, MAX_IDLE_LOOP, instructions, instructionLimit), &loop);
+        deliverKeys(cpu);
+        if (!loop.instructions) continue;
+
+        const uint64_t untilKey = untilReplayKey(cpu);
+        const uint64_t skipLimit = untilKey && (!instructionLimit || instructions + untilKey < instructionLimit) ? instructions + untilKey : instructionLimit;
+        if (!skipLimit && cpu->deadline == UINT64_MAX) {
+            waiting = true;
+            break;
+        }
+        instructions += skipIdleLoop(cpu, &loop, instructions, skipLimit);
+        deliverKeys(cpu);
+    }
+
+    // Everything the program printed comes before the results
+    if (cpu->console) flushConsole(cpu->console);
+    printf("\n%s PC=%.4x SP=%.2x A=%.2x X=%.2x Y=%.2x P=%.2x instructions=%llu cycles=%llu\n",
+        cpu->halted ? "Halted" : waiting ? "Waiting for input" : "Stopped at limit",
+        cpu->PC, cpu->SP, cpu->AC, cpu->X, cpu->Y, getStatus(cpu),
+        (unsigned long long)instructions, (unsigned long long)cpu->cycles);
+
+    if (history) {
+        const uint64_t target = rewindCycles < cpu->cycles ? cpu->cycles - rewindCycles : 0;
+        if (!rewindTo(history, cpu, target)) {
+            printf("The history doesn't go back %llu cycles\n", (unsigned long long)rewindCycles);
+            exit(1);
+        }
+        destroyRewind(history);
+        if (cpu->console) flushConsole(cpu->console);
+
+        // Only a halt can end the forward run early, and the run that recorded the history got past the target
+        if (cpu->cycles < target) {
+            printf("Rewinding stopped at %llu cycles, short of %llu\n", (unsigned long long)cpu->cycles, (unsigned long long)target);
+            exit(1);
+        }
+
+        printf("Rewound to PC=%.4x SP=%.2x A=%.2x X=%.2x Y=%.2x P=%.2x cycles=%llu\n",
+            cpu->PC, cpu->SP, cpu->AC, cpu->X, cpu->Y, getStatus(cpu), (unsigned long long)cpu->cycles);
+    }
+
+    if (dumpName) dumpFramebuffer(cpu, dumpName);
+}
\ No newline at end of file
@@ -0,0 +1,6 @@
+#include <stdint.h>
+
+// Runs cpu as fast as possible with no window until it halts or reaches a limit, 0 for no limit
+// Then goes back rewindCycles cycles if that isn't 0, to look at what led up to the end
+// Then prints the final registers, and writes the framebuffer to dumpName as a PPM image unless it's NULL
+void runHeadless(cpu6502* cpu, uint64_t instructionLimit, uint64_t cycleLimit, uint64_t rewindCycles, const char* dumpName);
\ No newline at end of file
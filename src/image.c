@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "emulate.h"
+#include "image.h"
+
+// Program images
+//
+// Most programs only fill a little of memory, so besides raw 64KiB images there are formats that leave the zeros out.
+// Files are told apart by how they start:
+//
+//   "6502SEG1" - segments, each a 2 byte address, a 2 byte length and then that many bytes
+//   "6502RLE1" - PackBits runs that unpack to exactly 64KiB. A header byte n below 128 is followed by n + 1 bytes to copy,
+//                otherwise by one byte to repeat n - 125 times
+//   65536 bytes - a raw image
+//   ':'        - Intel HEX text, with data, end of file and extended address records
+//
+// A raw image's first byte can be ':', so files of exactly 64KiB are always raw.
+// Multi-byte fields are little endian. Memory that no segment or record covers is zero.
+
+#define SEGMENT_MAGIC "6502SEG1"
+#define RLE_MAGIC "6502RLE1"
+#define MAX_FILE_SIZE 0x40000 // Larger than a full image in any format
+#define SEGMENT_GAP 4 // Zeros at least this long end a segment, since a new segment header costs 4 bytes
+#define HEX_RECORD_LENGTH 16
+
+// The whole file is read in one go
+static uint8_t* loadFile(const char * const fileName, size_t * const size) {
+    FILE * const file = fopen(fileName, "rb");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    uint8_t * const data = malloc(MAX_FILE_SIZE + 1);
+    if (!data) {
+        printf("Failed to allocate memory for the file\n");
+        exit(1);
+    }
+
+    *size = fread(data, 1, MAX_FILE_SIZE + 1, file);
+    if (ferror(file)) {
+        printf("Failed to read file: %s\n", fileName);
+        exit(1);
+    }
+    fclose(file);
+
+    if (*size > MAX_FILE_SIZE) {
+        printf("Input file is too large: %s\n", fileName);
+        exit(1);
+    }
+    return data;
+}
+
+static void readSegments(uint8_t * const image, const uint8_t * const data, const size_t size, const char * const fileName) {
+    size_t i = 8;
+    while (i < size) {
+        if (size - i < 4) {
+            printf("Incomplete segment header in %s\n", fileName);
+            exit(1);
+        }
+
+        const uint16_t address = data[i] | data[i + 1] << 8;
+        const uint16_t length = data[i + 2] | data[i + 3] << 8;
+        i += 4;
+
+        if (address + length > 0x10000 || size - i < length) {
+            printf("Segment at %.4x in %s runs past the end of %s\n", address, fileName, size - i < length ? "the file" : "memory");
+            exit(1);
+        }
+        memcpy(&image[address], &data[i], length);
+        i += length;
+    }
+}
+
+static void readRunLengths(uint8_t * const image, const uint8_t * const data, const size_t size, const char * const fileName) {
+    uint32_t address = 0;
+    size_t i = 8;
+    while (i < size) {
+        const uint8_t header = data[i++];
+        const uint32_t length = header < 128 ? header + 1 : header - 125;
+        if (address + length > 0x10000 || i + (header < 128 ? length : 1) > size) break;
+
+        if (header < 128) {
+            memcpy(&image[address], &data[i], length);
+            i += length;
+        } else {
+            memset(&image[address], data[i++], length);
+        }
+        address += length;
+    }
+
+    if (i != size || address != 0x10000) {
+        printf("Expected %s to unpack to exactly 65536 bytes\n", fileName);
+        exit(1);
+    }
+}
+
+static int hexDigit(const uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Returns -1 if either character isn't a hex digit
+static int hexByte(const uint8_t * const text) {
+    const int high = hexDigit(text[0]);
+    const int low = hexDigit(text[1]);
+    return high < 0 || low < 0 ? -1 : high << 4 | low;
+}
+
+static void readHex(uint8_t * const image, const uint8_t * const data, const size_t size, const char * const fileName) {
+    uint32_t base = 0; // From extended address records, which have to stay in the first 64KiB
+    uint32_t line = 1;
+    size_t i = 0;
+
+    while (true) {
+        // Skip line endings and trailing whitespace between records
+        while (i < size && (data[i] == '\r' || data[i] == '\n' || data[i] == ' ' || data[i] == '\t')) {
+            if (data[i] == '\n') line++;
+            i++;
+        }
+        if (i == size) {
+            printf("%s:%u: Expected an end of file record\n", fileName, line);
+            exit(1);
+        }
+
+        // Each record is : then the length, address, type, data and checksum as hex bytes
+        uint8_t record[5 + 0xff];
+        int length = -1;
+        if (data[i] == ':' && size - i >= 3) length = hexByte(&data[i + 1]);
+        if (length < 0 || size - i < 1 + (5 + (size_t)length) * 2) {
+            printf("%s:%u: Invalid record\n", fileName, line);
+            exit(1);
+        }
+
+        uint8_t checksum = 0;
+        for (int j = 0; j < 5 + length; j++) {
+            const int byte = hexByte(&data[i + 1 + j * 2]);
+            if (byte < 0) {
+                printf("%s:%u: Invalid record\n", fileName, line);
+                exit(1);
+            }
+            record[j] = byte;
+            checksum += byte;
+        }
+        i += 1 + (5 + length) * 2;
+
+        if (checksum != 0) {
+            printf("%s:%u: Checksum doesn't match\n", fileName, line);
+            exit(1);
+        }
+
+        const uint32_t address = base + (record[1] << 8 | record[2]);
+        switch (record[3]) {
+            case 0x00: // Data
+            if (address + length > 0x10000) {
+                printf("%s:%u: Record runs past the end of memory\n", fileName, line);
+                exit(1);
+            }
+            memcpy(&image[address], &record[4], length);
+            break;
+
+            case 0x01: // End of file
+            return;
+
+            case 0x02: // Extended segment address
+            case 0x04: // Extended linear address
+            if (length != 2) {
+                printf("%s:%u: Invalid record\n", fileName, line);
+                exit(1);
+            }
+            base = (record[4] << 8 | record[5]) << (record[3] == 0x02 ? 4 : 16);
+            if (base >= 0x10000) {
+                printf("%s:%u: Address is past the end of memory\n", fileName, line);
+                exit(1);
+            }
+            break;
+
+            case 0x03: // Start addresses, the reset vector is used instead
+            case 0x05:
+            break;
+
+            default:
+            printf("%s:%u: Unknown record type %.2x\n", fileName, line, record[3]);
+            exit(1);
+        }
+    }
+}
+
+void readFile(uint8_t * const image, const char * const fileName) {
+    size_t size;
+    uint8_t * const data = loadFile(fileName, &size);
+
+    if (size >= 8 && memcmp(data, SEGMENT_MAGIC, 8) == 0) {
+        memset(image, 0, 0x10000);
+        readSegments(image, data, size, fileName);
+    } else if (size >= 8 && memcmp(data, RLE_MAGIC, 8) == 0) {
+        readRunLengths(image, data, size, fileName);
+    } else if (size == 0x10000) {
+        memcpy(image, data, 0x10000);
+    } else if (size > 0 && data[0] == ':') {
+        memset(image, 0, 0x10000);
+        readHex(image, data, size, fileName);
+    } else {
+        printf("Expected input file to be a 65536 byte image, or a segment, RLE or Intel HEX file, got %llu bytes\n", (unsigned long long)size);
+        exit(1);
+    }
+
+    free(data);
+}
+
+static void writeSegments(const uint8_t * const image, FILE * const file) {
+    fwrite(SEGMENT_MAGIC, 1, 8, file);
+
+    uint32_t address = 0;
+    while (address < 0x10000) {
+        if (!image[address]) {
+            address++;
+            continue;
+        }
+
+        // Runs until a gap of zeros that would cost more than a new segment, or the longest a segment can be
+        uint32_t end = address;
+        uint32_t zeros = 0;
+        while (end < 0x10000 && end - address < 0xffff && zeros < SEGMENT_GAP) {
+            zeros = image[end] ? 0 : zeros + 1;
+            end++;
+        }
+        const uint32_t length = end - address - zeros;
+
+        const uint8_t header[4] = { address & 0xff, address >> 8, length & 0xff, length >> 8 };
+        fwrite(header, 1, 4, file);
+        fwrite(&image[address], 1, length, file);
+        address = end;
+    }
+}
+
+static void writeRunLengths(const uint8_t * const image, FILE * const file) {
+    fwrite(RLE_MAGIC, 1, 8, file);
+
+    uint32_t address = 0;
+    while (address < 0x10000) {
+        uint32_t run = 1;
+        while (address + run < 0x10000 && run < 130 && image[address + run] == image[address]) run++;
+
+        if (run >= 3) {
+            putc(run + 125, file);
+            putc(image[address], file);
+            address += run;
+            continue;
+        }
+
+        // Copy bytes up to the next run worth encoding
+        uint32_t end = address;
+        while (end < 0x10000 && end - address < 128) {
+            if (end + 2 < 0x10000 && image[end] == image[end + 1] && image[end] == image[end + 2]) break;
+            end++;
+        }
+        putc(end - address - 1, file);
+        fwrite(&image[address], 1, end - address, file);
+        address = end;
+    }
+}
+
+static void writeHexRecord(FILE * const file, const uint8_t type, const uint16_t address, const uint8_t * const data, const uint8_t length) {
+    uint8_t checksum = length + (address >> 8) + (address & 0xff) + type;
+    fprintf(file, ":%.2X%.4X%.2X", length, address, type);
+    for (uint8_t i = 0; i < length; i++) {
+        fprintf(file, "%.2X", data[i]);
+        checksum += data[i];
+    }
+    fprintf(file, "%.2X\n", (uint8_t)-checksum);
+}
+
+static void writeHex(const uint8_t * const image, FILE * const file) {
+    static const uint8_t zeros[HEX_RECORD_LENGTH];
+    for (uint32_t address = 0; address < 0x10000; address += HEX_RECORD_LENGTH) {
+        if (memcmp(&image[address], zeros, HEX_RECORD_LENGTH) != 0) writeHexRecord(file, 0x00, address, &image[address], HEX_RECORD_LENGTH);
+    }
+    writeHexRecord(file, 0x01, 0, NULL, 0);
+}
+
+static bool hasExtension(const char * const fileName, const char * const extension) {
+    const size_t nameLength = strlen(fileName);
+    const size_t length = strlen(extension);
+    return nameLength > length && strcmp(&fileName[nameLength - length], extension) == 0;
+}
+
+void writeImage(const uint8_t * const image, const char * const fileName) {
+    FILE * const file = fopen(fileName, "wb");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    if (hasExtension(fileName, ".seg")) {
+        writeSegments(image, file);
+    } else if (hasExtension(fileName, ".rle")) {
+        writeRunLengths(image, file);
+    } else if (hasExtension(fileName, ".hex")) {
+        writeHex(image, file);
+    } else {
+        fwrite(image, 1, 0x10000, file);
+    }
+
+    if (ferror(file) || fclose(file) != 0) {
+        printf("Failed to write file: %s\n", fileName);
+        exit(1);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#include <stdint.h>
+
+// Reads a program image into the 64KiB image, in any of the formats in image.c
+// Memory the file doesn't cover is zeroed
+void readFile(uint8_t* image, const char* fileName);
+
+// Writes a 64KiB image in the format picked by the file's extension,
+// .seg for segments, .rle for run length encoding, .hex for Intel HEX, and raw for anything else
+void writeImage(const uint8_t* image, const char* fileName);
\ No newline at end of file
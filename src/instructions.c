@@ -1,673 +1,724 @@
 #include <stdio.h>
 #include <stdint.h>
-#include <GLFW/glfw3.h>
 #include <pthread.h>
-#include "instructions.h"
 #include "emulate.h"
-#include "display.h"
+#include "instructions.h"
+#include "console.h"
+#include "interrupts.h"
 
-uint16_t readWord(const uint16_t pointer) {
-    const uint16_t hi = mem[pointer + 1] << 8;
-    const uint8_t lo = mem[pointer];
+uint16_t readWord(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint16_t hi = cpu->mem[pointer + 1] << 8;
+    const uint8_t lo = cpu->mem[pointer];
     return hi + lo;
 }
 
-static inline void setZeroFlag(const uint8_t val) {
-    zeroFlag = val == 0;
+// N and Z are only worked out from these values when they're read, see getStatus
+static inline void setZeroFlag(cpu6502 * const cpu, const uint8_t val) {
+    cpu->zeroResult = val;
 }
 
-static inline void setNegativeFlag(const uint8_t val) {
-    negativeFlag = val & 0x80;
+static inline void setNegativeFlag(cpu6502 * const cpu, const uint8_t val) {
+    cpu->negativeResult = val;
 }
 
-static inline void pushStack(const uint8_t val) {
-    mem[0x100 + SP--] = val;
+static inline void setZeroNegativeFlags(cpu6502 * const cpu, const uint8_t val) {
+    cpu->zeroResult = val;
+    cpu->negativeResult = val;
 }
 
-static inline uint8_t pullStack(void) {
-    return mem[0x100 + (++SP)];
+static inline void pushStack(cpu6502 * const cpu, const uint8_t val) {
+    cpu->mem[0x100 + cpu->SP--] = val;
+    cpu->writtenPages[1] = 1; // Pushes skip checkCodeWrite, but the rewind buffer still has to see them
 }
 
-static void pushStatus(void) {
-    uint8_t status = 0;
-    status |= (uint8_t)(negativeFlag) << 7;
-    status |= (uint8_t)(overflowFlag) << 6;
-    status |= 0x30; // Bit 5 is always 1, bit 4 is 1 when pushed from BRK or PHP (always)
-    status |= (uint8_t)(decimalFlag) << 3;
-    status |= (uint8_t)(interruptFlag) << 2;
-    status |= (uint8_t)(zeroFlag) << 1;
-    status |= (uint8_t)(carryFlag);
-    pushStack(status);
+static inline uint8_t pullStack(cpu6502 * const cpu) {
+    return cpu->mem[0x100 + (++cpu->SP)];
 }
 
-static void pullStatus(void) {
-    const uint8_t status = pullStack();
-    negativeFlag = status & 0x80;
-    overflowFlag = status & 0x40;
-    decimalFlag = status & 0x08;
-    interruptFlag = status & 0x04;
-    zeroFlag = status & 0x02;
-    carryFlag = status & 0x01;
+static void pushStatus(cpu6502 * const cpu) {
+    // Bit 5 is always 1, bit 4 is 1 when pushed from BRK or PHP (always)
+    pushStack(cpu, getStatus(cpu) | FLAG_UNUSED | FLAG_BREAK);
 }
 
-static void writeByte(const uint16_t pointer, const uint8_t byte) {
-    if (pointer == 0xfffa) {
-        putchar(byte);
-    } else if (pointer == 0xfffb) {
-        const double endTime = glfwGetTime() + ((double)byte) / 1000.0;
-        while (!glfwWindowShouldClose(window) && glfwGetTime() < endTime) {}
-    }
+static void pullStatus(cpu6502 * const cpu) {
+    setStatus(cpu, pullStack(cpu) & ~(FLAG_UNUSED | FLAG_BREAK));
+}
 
-    mem[pointer] = byte;
+static void stopInfiniteLoop(cpu6502 * const cpu) {
+    if (cpu->halted || canInterrupt(cpu)) return;
+    if (cpu->console) printConsole(cpu->console, "\nInfinite loop at 0x%.4x\n", cpu->PC);
+    haltCpu(cpu);
 }
 
-// Instructions
+// A CPU stops when it runs an instruction that jumps to itself, unless it's waiting there for an interrupt
+// Only jumps can leave PC where it was, so they check for it rather than every instruction
+static inline void jump(cpu6502 * const cpu, const uint16_t from, const uint16_t target) {
+    cpu->PC = target;
+    if (target == from) stopInfiniteLoop(cpu);
+}
 
-void ADC(const uint16_t pointer) {
-    const uint8_t binaryResult = AC + mem[pointer] + carryFlag;
+// Taken branches take an extra cycle, and another if the target is on a different page
+static inline void branch(cpu6502 * const cpu, const uint16_t pointer, const bool taken) {
+    cpu->PC++;
+    if (taken) {
+        const uint16_t target = cpu->PC + (int8_t)cpu->mem[pointer];
+        cpu->cycles += (cpu->PC ^ target) > 0xff ? 2 : 1;
+        jump(cpu, cpu->PC - 2, target);
+    }
+}
 
-    if (decimalFlag) {
-        // Implemented according to http://www.6502.org/tutorials/decimal_mode.html APPENDIX A
+// Pages without a device are plain memory, which is all the common case pays for
+// Devices can't be mapped to the zero page or stack, so the check is compiled out for zero page addresses
+static inline uint8_t readByte(cpu6502 * const cpu, const uint16_t pointer) {
+    if (pointer > 0x1ff && (cpu->pages[pointer >> 8] & PAGE_READ)) return readDevice(cpu, pointer);
+    return cpu->mem[pointer];
+}
 
-        const uint8_t oldACValue = AC;
+// Store without device side effects
+// Some illegal instructions use memory as scratch space this way, after writing the real value with writeByte
+static inline void storeByte(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    cpu->mem[pointer] = byte;
+    checkCodeWrite(cpu, pointer);
+}
 
-        uint16_t resultLow = (AC & 0xf) + (mem[pointer] & 0xf) + carryFlag;
-        if (resultLow >= 0xa) {
-            resultLow = ((resultLow + 6) & 0xf) + 0x10;
-        }
+static inline void writeByte(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    // Stored first, so devices can give registers new values
+    storeByte(cpu, pointer, byte);
+    if (pointer > 0x1ff && (cpu->pages[pointer >> 8] & PAGE_WRITE)) writeDevice(cpu, pointer, byte);
+}
 
-        int16_t result = (AC & 0xf0) + (mem[pointer] & 0xf0) + resultLow;
-        if (result >= 0xa0) {
-            result += 0x60;
-        }
+// Decimal mode
+// ADC and SBC results for every carry, accumulator and operand are worked out once,
+// so decimal arithmetic is a single table load instead of a branchy BCD correction
+
+typedef struct {
+    uint8_t result;
+    uint8_t flags; // N, V, Z and C, as an NMOS 6502 sets them
+} decimalResult;
+
+static decimalResult decimalAdd[2][0x100][0x100]; // Indexed by carry, AC then operand
+static decimalResult decimalSubtract[2][0x100][0x100];
+static pthread_once_t decimalTablesBuilt = PTHREAD_ONCE_INIT;
 
-        AC = result & 0xff;
+// Implemented according to http://www.6502.org/tutorials/decimal_mode.html APPENDIX A
 
-        carryFlag = result > 0xff;
+static decimalResult addDecimal(const uint8_t AC, const uint8_t value, const uint8_t carry) {
+    const uint8_t binaryResult = AC + value + carry;
 
-        result = ((int8_t)oldACValue & 0xf0) + ((int8_t)mem[pointer] & 0xf0) + resultLow;
-        setNegativeFlag(result);
-        overflowFlag = result < -128 || result > 127;
-    } else {
-        const uint16_t carryCheck = AC + mem[pointer] + carryFlag;
-        const int16_t overflowCheck = (int8_t)AC + (int8_t)mem[pointer] + carryFlag;
+    uint16_t resultLow = (AC & 0xf) + (value & 0xf) + carry;
+    if (resultLow >= 0xa) {
+        resultLow = ((resultLow + 6) & 0xf) + 0x10;
+    }
 
-        AC = binaryResult;
-        carryFlag = carryCheck > 0xff;
-        overflowFlag = overflowCheck > 127 || overflowCheck < -128;
-        setNegativeFlag(AC);
+    int16_t result = (AC & 0xf0) + (value & 0xf0) + resultLow;
+    if (result >= 0xa0) {
+        result += 0x60;
     }
 
-    setZeroFlag(binaryResult);
+    const uint8_t carryFlag = result > 0xff ? FLAG_CARRY : 0;
 
-    PC++;
+    // N and V come from before the high digit is corrected, Z comes from the binary result
+    const int16_t signedResult = ((int8_t)AC & 0xf0) + ((int8_t)value & 0xf0) + resultLow;
+    return (decimalResult){
+        .result = result & 0xff,
+        .flags = carryFlag | (signedResult & FLAG_NEGATIVE) | (signedResult < -128 || signedResult > 127 ? FLAG_OVERFLOW : 0)
+            | (binaryResult == 0 ? FLAG_ZERO : 0)
+    };
 }
 
-void AND(const uint16_t pointer) {
-    AC &= mem[pointer];
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+static decimalResult subtractDecimal(const uint8_t AC, const uint8_t value, const uint8_t carry) {
+    int16_t resultLow = (AC & 0xf) - (value & 0xf) - 1 + carry;
+    if (resultLow < 0) {
+        resultLow = ((resultLow - 6) & 0xf) - 0x10;
+    }
+
+    int16_t result = (AC & 0xf0) - (value & 0xf0) + resultLow;
+    if (result < 0) {
+        result -= 0x60;
+    }
+
+    // Every flag is the same as in binary mode
+    const uint16_t carryCheck = AC - value - 1 + carry;
+    const int16_t overflowCheck = (int8_t)AC - (int8_t)value - 1 + carry;
+    const uint8_t binaryResult = carryCheck;
+    return (decimalResult){
+        .result = result & 0xff,
+        .flags = (carryCheck <= 0xff ? FLAG_CARRY : 0) | (binaryResult & FLAG_NEGATIVE)
+            | (overflowCheck > 127 || overflowCheck < -128 ? FLAG_OVERFLOW : 0) | (binaryResult == 0 ? FLAG_ZERO : 0)
+    };
+}
+
+static void buildDecimalTables(void) {
+    for (uint32_t carry = 0; carry < 2; carry++) {
+        for (uint32_t AC = 0; AC < 0x100; AC++) {
+            for (uint32_t value = 0; value < 0x100; value++) {
+                decimalAdd[carry][AC][value] = addDecimal(AC, value, carry);
+                decimalSubtract[carry][AC][value] = subtractDecimal(AC, value, carry);
+            }
+        }
+    }
 }
 
-void ASL(const uint16_t pointer) {
-    carryFlag = mem[pointer] & 0x80;
-    writeByte(pointer, mem[pointer] << 1);
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void initInstructions(void) {
+    pthread_once(&decimalTablesBuilt, &buildDecimalTables);
 }
 
-void ASLA(void) {
-    carryFlag = AC & 0x80;
-    AC = AC << 1;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+static inline void setDecimalResult(cpu6502 * const cpu, const decimalResult * const result) {
+    cpu->AC = result->result;
+    cpu->P = (cpu->P & ~(FLAG_CARRY | FLAG_OVERFLOW)) | (result->flags & (FLAG_CARRY | FLAG_OVERFLOW));
+    cpu->zeroResult = ~result->flags & FLAG_ZERO;
+    cpu->negativeResult = result->flags;
 }
 
-void BCC(const uint16_t pointer) {
-    if (!carryFlag) {
-        PC += ((int8_t)mem[pointer]);
+// Instructions
+
+void ADC(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+
+    if (getFlag(cpu, FLAG_DECIMAL)) {
+        setDecimalResult(cpu, &decimalAdd[getFlag(cpu, FLAG_CARRY)][cpu->AC][value]);
+        cpu->PC++;
+        return;
     }
-    PC++;
+
+    const uint16_t carryCheck = cpu->AC + value + getFlag(cpu, FLAG_CARRY);
+    const int16_t overflowCheck = (int8_t)cpu->AC + (int8_t)value + getFlag(cpu, FLAG_CARRY);
+
+    cpu->AC = carryCheck;
+    setFlag(cpu, FLAG_CARRY, carryCheck > 0xff);
+    setFlag(cpu, FLAG_OVERFLOW, overflowCheck > 127 || overflowCheck < -128);
+    setZeroNegativeFlags(cpu, cpu->AC);
+
+    cpu->PC++;
 }
 
-void BCS(const uint16_t pointer) {
-    if (carryFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void AND(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->AC &= readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void BEQ(const uint16_t pointer) {
-    if (zeroFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void ASL(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    const uint8_t result = value << 1;
+    setFlag(cpu, FLAG_CARRY, value & 0x80);
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
 }
 
-void BIT(const uint16_t pointer) {
-    setZeroFlag(AC & mem[pointer]);
-    overflowFlag = mem[pointer] & 0x40;
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void ASLA(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_CARRY, cpu->AC & 0x80);
+    cpu->AC = cpu->AC << 1;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void BMI(const uint16_t pointer) {
-    if (negativeFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void BCC(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, !getFlag(cpu, FLAG_CARRY));
 }
 
-void BNE(const uint16_t pointer) {
-    if (!zeroFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void BCS(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, getFlag(cpu, FLAG_CARRY));
 }
 
-void BPL(const uint16_t pointer) {
-    if (!negativeFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void BEQ(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, getFlag(cpu, FLAG_ZERO));
 }
 
-void BRK(void) {
-    PC += 2;
-    pushStack(PC >> 8);
-    pushStack(PC & 0xff);
-    pushStatus();
-    interruptFlag = true;
-    PC = readWord(0xfffe);
+void BIT(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    setZeroFlag(cpu, cpu->AC & value);
+    setFlag(cpu, FLAG_OVERFLOW, value & 0x40);
+    setNegativeFlag(cpu, value);
+    cpu->PC++;
 }
 
-void BVC(const uint16_t pointer) {
-    if (!overflowFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void BMI(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, getFlag(cpu, FLAG_NEGATIVE));
 }
 
-void BVS(const uint16_t pointer) {
-    if (overflowFlag) {
-        PC += ((int8_t)mem[pointer]);
-    }
-    PC++;
+void BNE(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, !getFlag(cpu, FLAG_ZERO));
+}
+
+void BPL(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, !getFlag(cpu, FLAG_NEGATIVE));
 }
 
-void CLC(void) {
-    carryFlag = false;
-    PC++;
+void BRK(cpu6502 * const cpu) {
+    const uint16_t from = cpu->PC;
+    cpu->PC += 2;
+    pushStack(cpu, cpu->PC >> 8);
+    pushStack(cpu, cpu->PC & 0xff);
+    pushStatus(cpu);
+    setFlag(cpu, FLAG_INTERRUPT, true);
+    jump(cpu, from, readWord(cpu, 0xfffe));
 }
 
-void CLD(void) {
-    decimalFlag = false;
-    PC++;
+void interrupt(cpu6502 * const cpu, const uint16_t vector) {
+    pushStack(cpu, cpu->PC >> 8);
+    pushStack(cpu, cpu->PC & 0xff);
+    pushStack(cpu, getStatus(cpu) | FLAG_UNUSED); // B is clear, which is how a handler tells an interrupt from BRK
+    setFlag(cpu, FLAG_INTERRUPT, true);
+    cpu->PC = readWord(cpu, vector);
+    cpu->cycles += 7;
 }
 
-void CLI(void) {
-    interruptFlag = false;
-    PC++;
+void BVC(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, !getFlag(cpu, FLAG_OVERFLOW));
 }
 
-void CLV(void) {
-    overflowFlag = false;
-    PC++;
+void BVS(cpu6502 * const cpu, const uint16_t pointer) {
+    branch(cpu, pointer, getFlag(cpu, FLAG_OVERFLOW));
 }
 
-void CMP(const uint16_t pointer) {
-    carryFlag = AC >= mem[pointer];
-    zeroFlag = AC == mem[pointer];
-    setNegativeFlag(AC - mem[pointer]);
-    PC++;
+void CLC(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_CARRY, false);
+    cpu->PC++;
 }
 
-void CPX(const uint16_t pointer) {
-    carryFlag = X >= mem[pointer];
-    zeroFlag = X == mem[pointer];
-    setNegativeFlag(X - mem[pointer]);
-    PC++;
+void CLD(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_DECIMAL, false);
+    cpu->PC++;
 }
 
-void CPY(const uint16_t pointer) {
-    carryFlag = Y >= mem[pointer];
-    zeroFlag = Y == mem[pointer];
-    setNegativeFlag(Y - mem[pointer]);
-    PC++;
+void CLI(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_INTERRUPT, false);
+    updateDeadline(cpu);
+    cpu->PC++;
 }
 
-void DEC(const uint16_t pointer) {
-    writeByte(pointer, mem[pointer] - 1);
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void CLV(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_OVERFLOW, false);
+    cpu->PC++;
 }
 
-void DEX(void) {
-    X--;
-    setZeroFlag(X);
-    setNegativeFlag(X);
-    PC++;
+void CMP(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    setFlag(cpu, FLAG_CARRY, cpu->AC >= value);
+    setZeroNegativeFlags(cpu, cpu->AC - value);
+    cpu->PC++;
 }
 
-void DEY(void) {
-    Y--;
-    setZeroFlag(Y);
-    setNegativeFlag(Y);
-    PC++;
+void CPX(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    setFlag(cpu, FLAG_CARRY, cpu->X >= value);
+    setZeroNegativeFlags(cpu, cpu->X - value);
+    cpu->PC++;
 }
 
-void EOR(const uint16_t pointer) {
-    AC ^= mem[pointer];
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void CPY(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    setFlag(cpu, FLAG_CARRY, cpu->Y >= value);
+    setZeroNegativeFlags(cpu, cpu->Y - value);
+    cpu->PC++;
 }
 
-void INC(const uint16_t pointer) {
-    writeByte(pointer, mem[pointer] + 1);
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void DEC(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t result = readByte(cpu, pointer) - 1;
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
 }
 
-void INX(void) {
-    X++;
-    setZeroFlag(X);
-    setNegativeFlag(X);
-    PC++;
+void DEX(cpu6502 * const cpu) {
+    cpu->X--;
+    setZeroNegativeFlags(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void INY(void) {
-    Y++;
-    setZeroFlag(Y);
-    setNegativeFlag(Y);
-    PC++;
+void DEY(cpu6502 * const cpu) {
+    cpu->Y--;
+    setZeroNegativeFlags(cpu, cpu->Y);
+    cpu->PC++;
 }
 
-void JMP(const uint16_t pointer) {
-    PC = pointer;
+void EOR(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->AC ^= readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void JSR(const uint16_t pointer) {
-    pushStack(PC >> 8);
-    pushStack(PC & 0xff);
-    PC = pointer;
+void INC(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t result = readByte(cpu, pointer) + 1;
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
 }
 
-void LDA(const uint16_t pointer) {
-    AC = mem[pointer];
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void INX(cpu6502 * const cpu) {
+    cpu->X++;
+    setZeroNegativeFlags(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void LDX(const uint16_t pointer) {
-    X = mem[pointer];
-    setZeroFlag(X);
-    setNegativeFlag(X);
-    PC++;
+void INY(cpu6502 * const cpu) {
+    cpu->Y++;
+    setZeroNegativeFlags(cpu, cpu->Y);
+    cpu->PC++;
 }
 
-void LDY(const uint16_t pointer) {
-    Y = mem[pointer];
-    setZeroFlag(Y);
-    setNegativeFlag(Y);
-    PC++;
+// PC is left on the last byte of the instruction, so it started 2 bytes back
+void JMP(cpu6502 * const cpu, const uint16_t pointer) {
+    jump(cpu, cpu->PC - 2, pointer);
 }
 
-void LSR(const uint16_t pointer) {
-    carryFlag = mem[pointer] & 0x01;
-    writeByte(pointer, mem[pointer] >> 1);
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void JSR(cpu6502 * const cpu, const uint16_t pointer) {
+    pushStack(cpu, cpu->PC >> 8);
+    pushStack(cpu, cpu->PC & 0xff);
+    jump(cpu, cpu->PC - 2, pointer);
 }
 
-void LSRA(void) {
-    carryFlag = AC & 0x01;
-    AC = AC >> 1;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void LDA(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->AC = readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void NOP(uint8_t bytes) {
-    PC += bytes; // Illegal versions might not be 1 byte
-    return;
+void LDX(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->X = readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void ORA(const uint16_t pointer) {
-    AC |= mem[pointer];
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void LDY(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->Y = readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->Y);
+    cpu->PC++;
 }
 
-void PHA(void) {
-    pushStack(AC);
-    PC++;
+void LSR(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    const uint8_t result = value >> 1;
+    setFlag(cpu, FLAG_CARRY, value & 0x01);
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
 }
 
-void PHP(void) {
-    pushStatus();
-    PC++;
+void LSRA(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_CARRY, cpu->AC & 0x01);
+    cpu->AC = cpu->AC >> 1;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void PLA(void) {
-    AC = pullStack();
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void NOP(cpu6502 * const cpu) {
+    cpu->PC++;
 }
 
-void PLP(void) {
-    pullStatus();
-    PC++;
+void ORA(cpu6502 * const cpu, const uint16_t pointer) {
+    cpu->AC |= readByte(cpu, pointer);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void ROL(const uint16_t pointer) {
-    const bool tmpCarryFlag = mem[pointer] & 0x80;
-    writeByte(pointer, (mem[pointer] << 1) | carryFlag);
-    carryFlag = tmpCarryFlag;
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void PHA(cpu6502 * const cpu) {
+    pushStack(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void ROLA(void) {
-    const bool tmpCarryFlag = AC & 0x80;
-    AC = (AC << 1) | carryFlag;
-    carryFlag = tmpCarryFlag;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void PHP(cpu6502 * const cpu) {
+    pushStatus(cpu);
+    cpu->PC++;
 }
 
-void ROR(const uint16_t pointer) {
-    const bool tmpCarryFlag = mem[pointer] & 0x01;
-    writeByte(pointer, (mem[pointer] >> 1) | (((uint8_t)carryFlag) << 7));
-    carryFlag = tmpCarryFlag;
-    setZeroFlag(mem[pointer]);
-    setNegativeFlag(mem[pointer]);
-    PC++;
+void PLA(cpu6502 * const cpu) {
+    cpu->AC = pullStack(cpu);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void RORA(void) {
-    const bool tmpCarryFlag = AC & 0x01;
-    AC = (AC >> 1) | (((uint8_t)carryFlag) << 7);
-    carryFlag = tmpCarryFlag;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void PLP(cpu6502 * const cpu) {
+    pullStatus(cpu);
+    updateDeadline(cpu);
+    cpu->PC++;
 }
 
-void RTI(void) {
-    pullStatus();
-    PC = pullStack();
-    PC |= pullStack() << 8;
+void ROL(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    const uint8_t result = (value << 1) | getFlag(cpu, FLAG_CARRY);
+    setFlag(cpu, FLAG_CARRY, value & 0x80);
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
 }
 
-void RTS(void) {
-    PC = pullStack();
-    PC |= pullStack() << 8;
-    PC++;
+void ROLA(cpu6502 * const cpu) {
+    const bool tmpCarryFlag = cpu->AC & 0x80;
+    cpu->AC = (cpu->AC << 1) | getFlag(cpu, FLAG_CARRY);
+    setFlag(cpu, FLAG_CARRY, tmpCarryFlag);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void SBC(const uint16_t pointer) {
-    const uint16_t carryCheck = AC - mem[pointer] - 1 + carryFlag;
-    const int16_t overflowCheck = (int8_t)AC - (int8_t)mem[pointer] - 1 + carryFlag;
+void ROR(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
+    const uint8_t result = (value >> 1) | (((uint8_t)getFlag(cpu, FLAG_CARRY)) << 7);
+    setFlag(cpu, FLAG_CARRY, value & 0x01);
+    writeByte(cpu, pointer, result);
+    setZeroNegativeFlags(cpu, result);
+    cpu->PC++;
+}
 
-    const uint8_t binaryResult = AC - mem[pointer] - 1 + carryFlag;
+void RORA(cpu6502 * const cpu) {
+    const bool tmpCarryFlag = cpu->AC & 0x01;
+    cpu->AC = (cpu->AC >> 1) | (((uint8_t)getFlag(cpu, FLAG_CARRY)) << 7);
+    setFlag(cpu, FLAG_CARRY, tmpCarryFlag);
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
+}
 
-    if (decimalFlag) {
-        // Implemented according to http://www.6502.org/tutorials/decimal_mode.html APPENDIX A
+void RTI(cpu6502 * const cpu) {
+    pullStatus(cpu);
+    updateDeadline(cpu);
+    const uint8_t lo = pullStack(cpu);
+    jump(cpu, cpu->PC, pullStack(cpu) << 8 | lo);
+}
 
-        int16_t resultLow = (AC & 0xf) - (mem[pointer] & 0xf) - 1 + carryFlag;
-        if (resultLow < 0) {
-            resultLow = ((resultLow - 6) & 0xf) - 0x10;
-        }
+void RTS(cpu6502 * const cpu) {
+    const uint8_t lo = pullStack(cpu);
+    jump(cpu, cpu->PC, (uint16_t)((pullStack(cpu) << 8 | lo) + 1));
+}
 
-        int16_t result = (AC & 0xf0) - (mem[pointer] & 0xf0) + resultLow;
-        if (result < 0) {
-            result -= 0x60;
-        }
+void SBC(cpu6502 * const cpu, const uint16_t pointer) {
+    const uint8_t value = readByte(cpu, pointer);
 
-        AC = result & 0xff;
-    } else {
-        AC = binaryResult;
+    if (getFlag(cpu, FLAG_DECIMAL)) {
+        setDecimalResult(cpu, &decimalSubtract[getFlag(cpu, FLAG_CARRY)][cpu->AC][value]);
+        cpu->PC++;
+        return;
     }
 
-    setZeroFlag(binaryResult);
-    overflowFlag = overflowCheck > 127 || overflowCheck < -128;
-    setNegativeFlag(binaryResult);
-    carryFlag = carryCheck <= 0xff;
+    const uint16_t carryCheck = cpu->AC - value - 1 + getFlag(cpu, FLAG_CARRY);
+    const int16_t overflowCheck = (int8_t)cpu->AC - (int8_t)value - 1 + getFlag(cpu, FLAG_CARRY);
+
+    cpu->AC = carryCheck;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    setFlag(cpu, FLAG_OVERFLOW, overflowCheck > 127 || overflowCheck < -128);
+    setFlag(cpu, FLAG_CARRY, carryCheck <= 0xff);
 
-    PC++;
+    cpu->PC++;
 }
 
-void SEC(void) {
-    carryFlag = true;
-    PC++;
+void SEC(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_CARRY, true);
+    cpu->PC++;
 }
 
-void SED(void) {
-    decimalFlag = true;
-    PC++;
+void SED(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_DECIMAL, true);
+    cpu->PC++;
 }
 
-void SEI(void) {
-    interruptFlag = true;
-    PC++;
+void SEI(cpu6502 * const cpu) {
+    setFlag(cpu, FLAG_INTERRUPT, true);
+    cpu->PC++;
 }
 
-void STA(const uint16_t pointer) {
-    writeByte(pointer, AC);
-    PC++;
+void STA(cpu6502 * const cpu, const uint16_t pointer) {
+    writeByte(cpu, pointer, cpu->AC);
+    cpu->PC++;
 }
 
-void STX(const uint16_t pointer) {
-    writeByte(pointer, X);
-    PC++;
+void STX(cpu6502 * const cpu, const uint16_t pointer) {
+    writeByte(cpu, pointer, cpu->X);
+    cpu->PC++;
 }
 
-void STY(const uint16_t pointer) {
-    writeByte(pointer, Y);
-    PC++;
+void STY(cpu6502 * const cpu, const uint16_t pointer) {
+    writeByte(cpu, pointer, cpu->Y);
+    cpu->PC++;
 }
 
-void TAX(void) {
-    X = AC;
-    setZeroFlag(X);
-    setNegativeFlag(X);
-    PC++;
+void TAX(cpu6502 * const cpu) {
+    cpu->X = cpu->AC;
+    setZeroNegativeFlags(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void TAY(void) {
-    Y = AC;
-    setZeroFlag(Y);
-    setNegativeFlag(Y);
-    PC++;
+void TAY(cpu6502 * const cpu) {
+    cpu->Y = cpu->AC;
+    setZeroNegativeFlags(cpu, cpu->Y);
+    cpu->PC++;
 }
 
-void TSX(void) {
-    X = SP;
-    setZeroFlag(X);
-    setNegativeFlag(X);
-    PC++;
+void TSX(cpu6502 * const cpu) {
+    cpu->X = cpu->SP;
+    setZeroNegativeFlags(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void TXA(void) {
-    AC = X;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void TXA(cpu6502 * const cpu) {
+    cpu->AC = cpu->X;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void TXS(void) {
-    SP = X;
-    PC++;
+void TXS(cpu6502 * const cpu) {
+    cpu->SP = cpu->X;
+    cpu->PC++;
 }
 
-void TYA(void) {
-    AC = Y;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void TYA(cpu6502 * const cpu) {
+    cpu->AC = cpu->Y;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
 // Illegal instructions
 
-void ALR(uint16_t pointer) {
-    uint8_t val = AC * mem[pointer];
-    carryFlag = val & 1;
+void ALR(cpu6502 * const cpu, uint16_t pointer) {
+    uint8_t val = cpu->AC * cpu->mem[pointer];
+    setFlag(cpu, FLAG_CARRY, val & 1);
     val >>= 1;
-    setZeroFlag(val);
-    setNegativeFlag(val);
-    PC++;
+    setZeroNegativeFlags(cpu, val);
+    cpu->PC++;
 }
 
-void ANC(uint16_t pointer) {
-    const uint8_t val = AC & mem[pointer];
-    carryFlag = val & 0x80;
-    setZeroFlag(val);
-    setNegativeFlag(val);
-    PC++;
+void ANC(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t val = cpu->AC & cpu->mem[pointer];
+    setFlag(cpu, FLAG_CARRY, val & 0x80);
+    setZeroNegativeFlags(cpu, val);
+    cpu->PC++;
 }
 
-void ANE(uint16_t pointer) {
+void ANE(cpu6502 * const cpu, uint16_t pointer) {
     // The 0xff is (AC | random value) where the random value is recommended to be 0xff
     // In the real chip, the value changes based on chip series, temperature, etc.
-    AC = 0xff & X & mem[pointer];
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+    cpu->AC = 0xff & cpu->X & cpu->mem[pointer];
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
+}
+
+void ARR(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t oldAC = cpu->AC;
+    const bool oldCarry = getFlag(cpu, FLAG_CARRY);
+    cpu->AC &= cpu->mem[pointer];
+    ADC(cpu, pointer); // To set overflow flag
+    ROR(cpu, pointer);
+    cpu->AC = oldAC;
+    storeByte(cpu, pointer, cpu->mem[pointer] | oldCarry << 7);
+    cpu->PC--;
 }
 
-void ARR(uint16_t pointer) {
-    const uint8_t oldAC = AC;
-    const bool oldCarry = carryFlag;
-    AC &= mem[pointer];
-    ADC(pointer); // To set overflow flag
-    ROR(pointer);
-    AC = oldAC;
-    mem[pointer] |= oldCarry << 7;
-    PC--;
+void DCP(cpu6502 * const cpu, uint16_t pointer) {
+    writeByte(cpu, pointer, readByte(cpu, pointer) - 1);
+    CMP(cpu, pointer);
 }
 
-void DCP(uint16_t pointer) {
-    mem[pointer] -= 1;
-    CMP(pointer);
+void DOP(cpu6502 * const cpu, uint16_t pointer) {
+    // 2 byte NOP, the operand is read but ignored
+    (void)pointer;
+    cpu->PC++;
 }
 
-void ISC(uint16_t pointer) {
-    mem[pointer]++;
-    SBC(pointer);
+void ISC(cpu6502 * const cpu, uint16_t pointer) {
+    writeByte(cpu, pointer, readByte(cpu, pointer) + 1);
+    SBC(cpu, pointer);
 }
 
-void JAM(void) {
-    printf("\nHit illegal JAM instruction %.2x at %.4x\n", mem[PC], PC);
-    glFinish(); // Flush any drawings that haven't been drawn yet
-    pthread_exit(NULL);
+void JAM(cpu6502 * const cpu) {
+    if (cpu->console) printConsole(cpu->console, "\nHit illegal JAM instruction %.2x at %.4x\n", cpu->mem[cpu->PC], cpu->PC);
+    haltCpu(cpu);
 }
 
-void LAS(uint16_t pointer) {
-    AC = mem[pointer] & SP;
-    X = AC;
-    SP = AC;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+void LAS(cpu6502 * const cpu, uint16_t pointer) {
+    cpu->AC = cpu->mem[pointer] & cpu->SP;
+    cpu->X = cpu->AC;
+    cpu->SP = cpu->AC;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void LAX(uint16_t pointer) {
-    LDA(pointer);
-    X = AC;
+void LAX(cpu6502 * const cpu, uint16_t pointer) {
+    LDA(cpu, pointer);
+    cpu->X = cpu->AC;
 }
 
-void LXA(uint16_t pointer) {
+void LXA(cpu6502 * const cpu, uint16_t pointer) {
     // The 0xff is (AC | random value) where the random value is recommended to be 0xff
     // In the real chip, the value changes based on chip series, temperature, etc.
-    AC = 0xff & mem[pointer];
-    X = AC;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
-    PC++;
+    cpu->AC = 0xff & cpu->mem[pointer];
+    cpu->X = cpu->AC;
+    setZeroNegativeFlags(cpu, cpu->AC);
+    cpu->PC++;
 }
 
-void RLA(uint16_t pointer) {
-    const uint8_t oldVal = mem[pointer];
-    ROL(pointer);
-    AC &= oldVal;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
+void RLA(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t oldVal = cpu->mem[pointer];
+    ROL(cpu, pointer);
+    cpu->AC &= oldVal;
+    setZeroNegativeFlags(cpu, cpu->AC);
 }
 
-void RRA(uint16_t pointer) {
-    const uint8_t oldVal = mem[pointer];
-    ROR(pointer);
-    const uint8_t newVal = mem[pointer];
-    mem[pointer] = oldVal;
-    ADC(pointer);
-    mem[pointer] = newVal;
-    PC--;
+void RRA(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t oldVal = cpu->mem[pointer];
+    ROR(cpu, pointer);
+    const uint8_t newVal = cpu->mem[pointer];
+    storeByte(cpu, pointer, oldVal);
+    ADC(cpu, pointer);
+    storeByte(cpu, pointer, newVal);
+    cpu->PC--;
 }
 
-void SAX(uint16_t pointer) {
-    mem[pointer] = AC & X;
-    PC++;
+void SAX(cpu6502 * const cpu, uint16_t pointer) {
+    writeByte(cpu, pointer, cpu->AC & cpu->X);
+    cpu->PC++;
 }
 
-void SBX(uint16_t pointer) {
-    X = AC & X;
-    carryFlag = X >= mem[pointer];
-    zeroFlag = X == mem[pointer];
-    X -= mem[pointer];
-    setNegativeFlag(X);
-    PC++;
+void SBX(cpu6502 * const cpu, uint16_t pointer) {
+    cpu->X = cpu->AC & cpu->X;
+    setFlag(cpu, FLAG_CARRY, cpu->X >= cpu->mem[pointer]);
+    setFlag(cpu, FLAG_ZERO, cpu->X == cpu->mem[pointer]);
+    cpu->X -= cpu->mem[pointer];
+    setNegativeFlag(cpu, cpu->X);
+    cpu->PC++;
 }
 
-void SHA(uint16_t pointer) {
+void SHA(cpu6502 * const cpu, uint16_t pointer) {
     // The (& mem[pointer + 1]) may be dropped, or not cross page boundaries
     // This behaviour is not emulated
-    mem[pointer] = AC & X & mem[(pointer + 1) & 0xffff];
-    PC++;
+    writeByte(cpu, pointer, cpu->AC & cpu->X & cpu->mem[(pointer + 1) & 0xffff]);
+    cpu->PC++;
 }
 
-void SHX(uint16_t pointer) {
+void SHX(cpu6502 * const cpu, uint16_t pointer) {
     // The (& mem[pointer + 1]) may be dropped, or not cross page boundaries
     // This behaviour is not emulated
-    mem[pointer] = X & mem[(pointer + 1) & 0xffff];
-    PC++;
+    writeByte(cpu, pointer, cpu->X & cpu->mem[(pointer + 1) & 0xffff]);
+    cpu->PC++;
 }
 
-void SHY(uint16_t pointer) {
+void SHY(cpu6502 * const cpu, uint16_t pointer) {
     // The (& mem[pointer + 1]) may be dropped, or not cross page boundaries
     // This behaviour is not emulated
-    mem[pointer] = Y & mem[(pointer + 1) & 0xffff];
-    PC++;
+    writeByte(cpu, pointer, cpu->Y & cpu->mem[(pointer + 1) & 0xffff]);
+    cpu->PC++;
+}
+
+void SLO(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t oldVal = cpu->mem[pointer];
+    ASL(cpu, pointer);
+    cpu->AC |= oldVal;
+    setZeroNegativeFlags(cpu, cpu->AC);
 }
 
-void SLO(uint16_t pointer) {
-    const uint8_t oldVal = mem[pointer];
-    ASL(pointer);
-    AC |= oldVal;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
+void SRE(cpu6502 * const cpu, uint16_t pointer) {
+    const uint8_t oldVal = cpu->mem[pointer];
+    LSR(cpu, pointer);
+    cpu->AC ^= oldVal;
+    setZeroNegativeFlags(cpu, cpu->AC);
 }
 
-void SRE(uint16_t pointer) {
-    const uint8_t oldVal = mem[pointer];
-    LSR(pointer);
-    AC ^= oldVal;
-    setZeroFlag(AC);
-    setNegativeFlag(AC);
+void TAS(cpu6502 * const cpu, uint16_t pointer) {
+    cpu->SP = cpu->AC & cpu->X;
+    SHA(cpu, pointer);
 }
 
-void TAS(uint16_t pointer) {
-    SP = AC & X;
-    SHA(pointer);
+void TOP(cpu6502 * const cpu, uint16_t pointer) {
+    // 3 byte NOP, the operand is read but ignored
+    (void)pointer;
+    cpu->PC++;
 }
\ No newline at end of file
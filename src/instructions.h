@@ -1,86 +1,94 @@
 #include <stdint.h>
 
-uint16_t readWord(uint16_t pointer);
+uint16_t readWord(cpu6502* cpu, uint16_t pointer);
 
-void ADC(uint16_t pointer);
-void AND(uint16_t pointer);
-void ASL(uint16_t pointer);
-void ASLA(void);
-void BCC(uint16_t pointer);
-void BCS(uint16_t pointer);
-void BEQ(uint16_t pointer);
-void BIT(uint16_t pointer);
-void BMI(uint16_t pointer);
-void BNE(uint16_t pointer);
-void BPL(uint16_t pointer);
-void BRK(void);
-void BVC(uint16_t pointer);
-void BVS(uint16_t pointer);
-void CLC(void);
-void CLD(void);
-void CLI(void);
-void CLV(void);
-void CMP(uint16_t pointer);
-void CPX(uint16_t pointer);
-void CPY(uint16_t pointer);
-void DEC(uint16_t pointer);
-void DEX(void);
-void DEY(void);
-void EOR(uint16_t pointer);
-void INC(uint16_t pointer);
-void INX(void);
-void INY(void);
-void JMP(uint16_t pointer);
-void JSR(uint16_t pointer);
-void LDA(uint16_t pointer);
-void LDX(uint16_t pointer);
-void LDY(uint16_t pointer);
-void LSR(uint16_t pointer);
-void LSRA(void);
-void NOP(uint8_t bytes);
-void ORA(uint16_t pointer);
-void PHA(void);
-void PHP(void);
-void PLA(void);
-void PLP(void);
-void ROL(uint16_t pointer);
-void ROLA(void);
-void ROR(uint16_t pointer);
-void RORA(void);
-void RTI(void);
-void RTS(void);
-void SBC(uint16_t pointer);
-void SEC(void);
-void SED(void);
-void SEI(void);
-void STA(uint16_t pointer);
-void STX(uint16_t pointer);
-void STY(uint16_t pointer);
-void TAX(void);
-void TAY(void);
-void TSX(void);
-void TXA(void);
-void TXS(void);
-void TYA(void);
+// Builds the decimal mode tables, must be called before any instruction runs
+void initInstructions(void);
+
+// Takes an interrupt through the vector, pushing PC and the status as BRK does, between instructions
+void interrupt(cpu6502* cpu, uint16_t vector);
+
+void ADC(cpu6502* cpu, uint16_t pointer);
+void AND(cpu6502* cpu, uint16_t pointer);
+void ASL(cpu6502* cpu, uint16_t pointer);
+void ASLA(cpu6502* cpu);
+void BCC(cpu6502* cpu, uint16_t pointer);
+void BCS(cpu6502* cpu, uint16_t pointer);
+void BEQ(cpu6502* cpu, uint16_t pointer);
+void BIT(cpu6502* cpu, uint16_t pointer);
+void BMI(cpu6502* cpu, uint16_t pointer);
+void BNE(cpu6502* cpu, uint16_t pointer);
+void BPL(cpu6502* cpu, uint16_t pointer);
+void BRK(cpu6502* cpu);
+void BVC(cpu6502* cpu, uint16_t pointer);
+void BVS(cpu6502* cpu, uint16_t pointer);
+void CLC(cpu6502* cpu);
+void CLD(cpu6502* cpu);
+void CLI(cpu6502* cpu);
+void CLV(cpu6502* cpu);
+void CMP(cpu6502* cpu, uint16_t pointer);
+void CPX(cpu6502* cpu, uint16_t pointer);
+void CPY(cpu6502* cpu, uint16_t pointer);
+void DEC(cpu6502* cpu, uint16_t pointer);
+void DEX(cpu6502* cpu);
+void DEY(cpu6502* cpu);
+void EOR(cpu6502* cpu, uint16_t pointer);
+void INC(cpu6502* cpu, uint16_t pointer);
+void INX(cpu6502* cpu);
+void INY(cpu6502* cpu);
+void JMP(cpu6502* cpu, uint16_t pointer);
+void JSR(cpu6502* cpu, uint16_t pointer);
+void LDA(cpu6502* cpu, uint16_t pointer);
+void LDX(cpu6502* cpu, uint16_t pointer);
+void LDY(cpu6502* cpu, uint16_t pointer);
+void LSR(cpu6502* cpu, uint16_t pointer);
+void LSRA(cpu6502* cpu);
+void NOP(cpu6502* cpu);
+void ORA(cpu6502* cpu, uint16_t pointer);
+void PHA(cpu6502* cpu);
+void PHP(cpu6502* cpu);
+void PLA(cpu6502* cpu);
+void PLP(cpu6502* cpu);
+void ROL(cpu6502* cpu, uint16_t pointer);
+void ROLA(cpu6502* cpu);
+void ROR(cpu6502* cpu, uint16_t pointer);
+void RORA(cpu6502* cpu);
+void RTI(cpu6502* cpu);
+void RTS(cpu6502* cpu);
+void SBC(cpu6502* cpu, uint16_t pointer);
+void SEC(cpu6502* cpu);
+void SED(cpu6502* cpu);
+void SEI(cpu6502* cpu);
+void STA(cpu6502* cpu, uint16_t pointer);
+void STX(cpu6502* cpu, uint16_t pointer);
+void STY(cpu6502* cpu, uint16_t pointer);
+void TAX(cpu6502* cpu);
+void TAY(cpu6502* cpu);
+void TSX(cpu6502* cpu);
+void TXA(cpu6502* cpu);
+void TXS(cpu6502* cpu);
+void TYA(cpu6502* cpu);
 
 // Illegal instructions
-void ALR(uint16_t pointer);
-void ANC(uint16_t pointer);
-void ANE(uint16_t pointer);
-void ARR(uint16_t pointer);
-void DCP(uint16_t pointer);
-void ISC(uint16_t pointer);
-void JAM(void);
-void LAS(uint16_t pointer);
-void LAX(uint16_t pointer);
-void LXA(uint16_t pointer);
-void RLA(uint16_t pointer);
-void RRA(uint16_t pointer);
-void SAX(uint16_t pointer);
-void SBX(uint16_t pointer);
-void SHA(uint16_t pointer);
-void SHX(uint16_t pointer);
-void SHY(uint16_t pointer);
-void SLO(uint16_t pointer);
-void SRE(uint16_t pointer);
-void TAS(uint16_t pointer);
\ No newline at end of file
+void ALR(cpu6502* cpu, uint16_t pointer);
+void ANC(cpu6502* cpu, uint16_t pointer);
+void ANE(cpu6502* cpu, uint16_t pointer);
+void ARR(cpu6502* cpu, uint16_t pointer);
+void DCP(cpu6502* cpu, uint16_t pointer);
+void DOP(cpu6502* cpu, uint16_t pointer);
+void ISC(cpu6502* cpu, uint16_t pointer);
+void JAM(cpu6502* cpu);
+void LAS(cpu6502* cpu, uint16_t pointer);
+void LAX(cpu6502* cpu, uint16_t pointer);
+void LXA(cpu6502* cpu, uint16_t pointer);
+void RLA(cpu6502* cpu, uint16_t pointer);
+void RRA(cpu6502* cpu, uint16_t pointer);
+void SAX(cpu6502* cpu, uint16_t pointer);
+void SBX(cpu6502* cpu, uint16_t pointer);
+void SHA(cpu6502* cpu, uint16_t pointer);
+void SHX(cpu6502* cpu, uint16_t pointer);
+void SHY(cpu6502* cpu, uint16_t pointer);
+void SLO(cpu6502* cpu, uint16_t pointer);
+void SRE(cpu6502* cpu, uint16_t pointer);
+void TAS(cpu6502* cpu, uint16_t pointer);
+void TOP(cpu6502* cpu, uint16_t pointer);
\ No newline at end of file
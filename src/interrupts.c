@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "emulate.h"
+#include "interrupts.h"
+#include "instructions.h"
+#include "scheduler.h"
+#include "governor.h"
+
+// Interrupts
+//
+// Devices mark themselves waiting in the status register, and the enable register routes each source to IRQ, NMI or neither.
+// Rather than the lines being looked at after every instruction, the deadline is set to 0 when an interrupt is ready to be taken,
+// or the CPU has halted, so the run stops after the current instruction. Otherwise it's the next scheduled event or the cycle limit.
+//
+// The state is kept in the CPU rather than in memory, so an image with bytes at the registers doesn't start with interrupts on.
+// The timer counts cycles at the CPU's clock rate, so it fires at the same point in every run of a program.
+
+#define IRQ_SOURCES(enable) ((enable) & 0x0f)
+#define NMI_SOURCES(enable) ((enable) >> 4)
+
+void updateDeadline(cpu6502 * const cpu) {
+    const bool irq = (cpu->interruptStatus & IRQ_SOURCES(cpu->interruptEnable)) && !getFlag(cpu, FLAG_INTERRUPT);
+    const uint64_t next = getNextEvent(cpu);
+    cpu->deadline = cpu->halted || cpu->nmiPending || irq ? 0 : next < cpu->cycleLimit ? next : cpu->cycleLimit;
+}
+
+// NMI is edge triggered, so it's only raised when the line goes from no sources waiting to some
+static void setInterrupts(cpu6502 * const cpu, const uint8_t status, const uint8_t enable) {
+    const bool nmiLine = cpu->interruptStatus & NMI_SOURCES(cpu->interruptEnable);
+    cpu->interruptStatus = status;
+    cpu->interruptEnable = enable;
+    if (!nmiLine && (status & NMI_SOURCES(enable))) cpu->nmiPending = true;
+    updateDeadline(cpu);
+}
+
+void raiseInterrupt(cpu6502 * const cpu, const uint8_t sources) {
+    setInterrupts(cpu, cpu->interruptStatus | sources, cpu->interruptEnable);
+}
+
+// Emulated time, so with an unlimited clock rate the timer counts at the default one
+static uint64_t getTimerCycles(const cpu6502 * const cpu) {
+    const uint64_t rate = cpu->clockRate ? cpu->clockRate : DEFAULT_CLOCK_RATE;
+    const uint64_t cycles = cpu->timerPeriod * rate / 1000;
+    return cycles ? cycles : 1;
+}
+
+static uint8_t readInterruptRegister(cpu6502 * const cpu, const uint16_t pointer) {
+    return pointer == INTERRUPT_STATUS_REGISTER ? cpu->interruptStatus : cpu->interruptEnable;
+}
+
+static void writeInterruptRegister(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    if (pointer == INTERRUPT_STATUS_REGISTER) {
+        setInterrupts(cpu, cpu->interruptStatus & ~byte, cpu->interruptEnable);
+    } else {
+        setInterrupts(cpu, cpu->interruptStatus, byte);
+    }
+}
+
+// Only the high byte is mapped, the low byte stays in memory until it's read from there
+static void writeTimer(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    cpu->timerPeriod = cpu->mem[TIMER_REGISTER] | byte << 8;
+    scheduleEvent(cpu, cpu->timerEvent, cpu->timerPeriod ? cpu->cycles + getTimerCycles(cpu) : UINT64_MAX);
+}
+
+static void fireTimer(cpu6502 * const cpu, const uint64_t cycle) {
+    // Counting on from when it was due rather than now keeps the period exact,
+    // and a delay that runs past several periods only raises the source once
+    const uint64_t period = getTimerCycles(cpu);
+    scheduleEvent(cpu, cpu->timerEvent, cycle + ((cpu->cycles - cycle) / period + 1) * period);
+    raiseInterrupt(cpu, INTERRUPT_TIMER);
+}
+
+void mapInterrupts(cpu6502 * const cpu) {
+    mapDevice(cpu, INTERRUPT_STATUS_REGISTER, INTERRUPT_ENABLE_REGISTER, &readInterruptRegister, &writeInterruptRegister);
+    mapDevice(cpu, TIMER_REGISTER + 1, TIMER_REGISTER + 1, NULL, &writeTimer);
+    cpu->timerEvent = addEvent(cpu, &fireTimer);
+}
+
+void resetInterrupts(cpu6502 * const cpu) {
+    cpu->interruptStatus = 0;
+    cpu->interruptEnable = 0;
+    cpu->nmiPending = false;
+    cpu->timerPeriod = 0;
+    scheduleEvent(cpu, cpu->timerEvent, UINT64_MAX);
+    updateDeadline(cpu);
+}
+
+void serviceEvents(cpu6502 * const cpu) {
+    runEvents(cpu);
+
+    // Taking an interrupt sets I, so at most one is taken here and the deadline is then past the cycle count
+    if (cpu->nmiPending) {
+        cpu->nmiPending = false;
+        interrupt(cpu, NMI_VECTOR);
+    } else if ((cpu->interruptStatus & IRQ_SOURCES(cpu->interruptEnable)) && !getFlag(cpu, FLAG_INTERRUPT)) {
+        interrupt(cpu, IRQ_VECTOR);
+    }
+    updateDeadline(cpu);
+}
+
+bool canInterrupt(const cpu6502 * const cpu) {
+    uint8_t sources = cpu->interruptStatus;
+    if (getEventCycle(cpu, cpu->timerEvent) != UINT64_MAX) sources |= INTERRUPT_TIMER;
+    if (cpu->keys) sources |= INTERRUPT_KEYBOARD;
+    if (getEventCycle(cpu, cpu->frameEvent) != UINT64_MAX) sources |= INTERRUPT_VSYNC;
+
+    const uint8_t routed = NMI_SOURCES(cpu->interruptEnable) | (getFlag(cpu, FLAG_INTERRUPT) ? 0 : IRQ_SOURCES(cpu->interruptEnable));
+    return cpu->nmiPending || (sources & routed);
+}
\ No newline at end of file
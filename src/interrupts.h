@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INTERRUPT_STATUS_REGISTER 0xfff2 // Sources waiting to be handled, writing 1 bits acknowledges those sources
+#define INTERRUPT_ENABLE_REGISTER 0xfff3 // Sources in bits 0-3 raise IRQ, sources in bits 4-7 raise NMI
+#define TIMER_REGISTER 0xfff4 // Period in milliseconds, 2 bytes little endian, writing the high byte starts the timer, 0 stops it
+
+// 0xFFFA - 0xFFFB are taken by the console and delay registers, so NMI has its vector below the start location
+#define NMI_VECTOR 0xffee
+#define IRQ_VECTOR 0xfffe // Shared with BRK
+
+// Interrupt sources, as bits of the status and enable registers
+#define INTERRUPT_TIMER 0x01
+#define INTERRUPT_KEYBOARD 0x02
+#define INTERRUPT_VSYNC 0x04 // Only raised once the frame counter is started
+
+// Maps the interrupt and timer registers, called by createCpu
+void mapInterrupts(cpu6502* cpu);
+
+// Stops the timer and clears every source and enable, as at power on
+void resetInterrupts(cpu6502* cpu);
+
+// Marks sources as waiting, for devices
+// NMI is edge triggered, so it's only raised when none of its sources were already waiting
+void raiseInterrupt(cpu6502* cpu, uint8_t sources);
+
+// Works out when runInstructions next needs to stop for an event, after anything that could change it
+// Called by the I flag instructions, so IRQs held back by the flag are taken as soon as it's cleared
+void updateDeadline(cpu6502* cpu);
+
+// Runs the events that are due, then takes any interrupt that's waiting and not masked
+// Called by runInstructions between instructions once the deadline has been reached
+void serviceEvents(cpu6502* cpu);
+
+// Whether an interrupt could still arrive, so a jump to itself is waiting for one rather than stuck
+bool canInterrupt(const cpu6502* cpu);
\ No newline at end of file
@@ -0,0 +1,952 @@
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "emulate.h"
+#include "jit.h"
+#include "opcodeinfo.h"
+
+// Compiles hot basic blocks of 6502 code to x86-64
+//
+// A block runs straight-line code and ends at the first branch or jump,
+// or just before an instruction the JIT doesn't handle, which is left to the interpreter.
+// Blocks that branch back to their own start loop without leaving native code.
+// Stores to a device page call writeDevice from the block, so drawing to the screen doesn't end it.
+//
+// While a block runs the 6502 registers and flags live in host registers:
+//   rbp = jitState, rbx = mem, rsi = instructions run, rdi = cycles run
+//   r12b = AC, r13b = X, r14b = Y, r15b = SP
+//   r8b = N, r9b = Z, r10b = C, r11b = V (each 0 or 1)
+//   rax, rcx and rdx are scratch
+
+#if !defined(__x86_64__) && !defined(_M_X64)
+#error "The JIT only supports x86-64 hosts"
+#endif
+
+#define JIT_THRESHOLD 32 // Times an address is interpreted before it's compiled
+#define JIT_UNCOMPILABLE 0xff // Heat value for addresses that shouldn't be compiled
+#define JIT_MAX_INSTRUCTIONS 64 // Instructions per block
+#define JIT_MAX_BLOCK_LENGTH 0xff // Bytes of 6502 code per block
+#define JIT_MAX_BLOCK_SIZE 0x4000 // Bytes of x86 code per block
+#define JIT_BUFFER_SIZE 0x400000
+
+// Passed to each block, which loads the registers from it and writes them back on exit
+typedef struct {
+    uint8_t* mem;
+    uint64_t cycles;
+    uint32_t loopLimit; // Blocks only loop again while they've run at most this many instructions
+    uint16_t PC;
+    uint16_t codeWriteAddress;
+    uint8_t codeWritten; // Set when a block wrote to a cached instruction and exited early
+    uint8_t AC;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t SP;
+    uint8_t negativeFlag;
+    uint8_t overflowFlag;
+    uint8_t zeroFlag;
+    uint8_t carryFlag;
+    uint8_t decimalFlag;
+} jitState;
+
+typedef uint32_t (*jitFunction)(jitState* state);
+
+// Each CPU compiles its own blocks, so CPUs on different threads never share any JIT state
+typedef struct jitCache {
+    uint8_t* codeBuffer;
+    size_t codeUsed;
+    size_t epilogueOffset;
+
+    uint8_t* blocks[0x10000];
+    uint8_t blockLengths[0x10000];
+    uint8_t heat[0x10000]; // Times each address has been interpreted
+    uint8_t bitmap[0x10000 / 8]; // Bytes of 6502 code covered by a compiled block
+} jitCache;
+
+// Device reads and read-modify-writes are left to the interpreter, stores are checked when they run
+// Zero page addresses can't be on a device page
+static bool reachesDevice(const cpu6502 * const cpu, const uint8_t mode, const uint16_t operand) {
+    switch (mode) {
+        case MODE_ZP: case MODE_ABS:
+        return isDevice(cpu, operand, PAGE_READ | PAGE_WRITE);
+
+        // The index can carry into the next page
+        case MODE_ABSX: case MODE_ABSY:
+        return (cpu->pages[operand >> 8] | cpu->pages[(uint8_t)((operand >> 8) + 1)]) & PAGE_READ;
+
+        default:
+        return false;
+    }
+}
+
+static bool isBranch(const uint8_t instruction) {
+    switch (instruction) {
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+static uint16_t readOperand(const uint8_t * const mem, const uint16_t address) {
+    const uint8_t lo = mem[(uint16_t)(address + 1)];
+    if (opcodeInfo[mem[address]].length == 2) return lo;
+    return (mem[(uint16_t)(address + 2)] << 8) + lo;
+}
+
+// Whether the JIT can compile the instruction at address
+static bool canCompile(const cpu6502 * const cpu, const uint16_t address) {
+    const uint8_t * const mem = cpu->mem;
+    const uint8_t opcode = mem[address];
+    const uint8_t instruction = opcodeInfo[opcode].instruction;
+    const uint8_t mode = opcodeInfo[opcode].mode;
+    const uint16_t operand = readOperand(mem, address);
+
+    // Stores are compiled in every addressing mode, and call the device themselves if they reach one
+    if (instruction == STA || instruction == STX || instruction == STY) return true;
+    if (reachesDevice(cpu, mode, operand)) return false;
+
+    switch (instruction) {
+        case LDA: case LDX: case LDY:
+        case ADC: case SBC: case AND: case ORA: case EOR: case CMP:
+        return mode != MODE_IND && mode != MODE_INDX && mode != MODE_INDY;
+
+        case INC: case DEC:
+        return mode == MODE_ZP || mode == MODE_ZPX || mode == MODE_ZPY || mode == MODE_ABS;
+
+        case ASL: case LSR: case ROL: case ROR:
+        case CPX: case CPY: case BIT:
+        return mode == MODE_IMM || mode == MODE_ZP || mode == MODE_ABS;
+
+        case ASLA: case LSRA: case ROLA: case RORA:
+        case INX: case INY: case DEX: case DEY:
+        case TAX: case TAY: case TXA: case TYA: case TSX: case TXS:
+        case CLC: case SEC: case CLV: case NOP:
+        return true;
+
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+        // Branches to themselves are left to the interpreter to detect
+        return mem[(uint16_t)(address + 1)] != 0xfe;
+
+        case JMP:
+        return mode == MODE_ABS && operand != address;
+
+        default:
+        return false;
+    }
+}
+
+// x86-64 encoding
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define REG_STATE RBP
+#define REG_MEM RBX
+#define REG_COUNT RSI
+#define REG_CYCLES RDI
+#define REG_AC R12
+#define REG_X R13
+#define REG_Y R14
+#define REG_SP R15
+#define REG_N R8
+#define REG_Z R9
+#define REG_C R10
+#define REG_V R11
+
+#ifdef _WIN32
+#define REG_ARG RCX
+#else
+#define REG_ARG RDI
+#endif
+
+// Condition codes
+enum { CC_O, CC_NO, CC_C, CC_NC, CC_Z, CC_NZ, CC_BE, CC_A, CC_S, CC_NS };
+
+// Register or memory operand for the r/m field of an instruction
+typedef struct {
+    int8_t reg; // -1 for a memory operand
+    int8_t base;
+    int8_t index; // -1 for no index
+    int32_t disp;
+} rmOperand;
+
+static rmOperand rmReg(const int8_t reg) {
+    return (rmOperand){ .reg = reg, .base = -1, .index = -1, .disp = 0 };
+}
+
+static rmOperand rmMem(const int8_t base, const int8_t index, const int32_t disp) {
+    return (rmOperand){ .reg = -1, .base = base, .index = index, .disp = disp };
+}
+
+static rmOperand rmState(const size_t offset) {
+    return rmMem(REG_STATE, -1, (int32_t)offset);
+}
+
+#define OP_BYTE 1 // 8 bit operands, always emit REX so r8b - r15b are usable
+#define OP_WIDE 2 // 64 bit operands
+#define OP_WORD 4 // 16 bit operands
+
+static void emit8(jitCache * const jit, const uint8_t byte) {
+    jit->codeBuffer[jit->codeUsed++] = byte;
+}
+
+static void emit16(jitCache * const jit, const uint16_t word) {
+    emit8(jit, word & 0xff);
+    emit8(jit, word >> 8);
+}
+
+static void emit32(jitCache * const jit, const uint32_t dword) {
+    emit16(jit, dword & 0xffff);
+    emit16(jit, dword >> 16);
+}
+
+static void emitRM(jitCache * const jit, const int flags, const uint8_t opcode1, const int opcode2, const int reg, const rmOperand rm) {
+    if (flags & OP_WORD) emit8(jit, 0x66);
+
+    uint8_t rex = 0x40;
+    if (flags & OP_WIDE) rex |= 0x08;
+    if (reg & 8) rex |= 0x04;
+    if (rm.reg >= 0) {
+        if (rm.reg & 8) rex |= 0x01;
+    } else {
+        if (rm.index >= 0 && (rm.index & 8)) rex |= 0x02;
+        if (rm.base & 8) rex |= 0x01;
+    }
+    if (rex != 0x40 || (flags & OP_BYTE)) emit8(jit, rex);
+
+    emit8(jit, opcode1);
+    if (opcode2 >= 0) emit8(jit, opcode2);
+
+    if (rm.reg >= 0) {
+        emit8(jit, 0xc0 | (reg & 7) << 3 | (rm.reg & 7));
+        return;
+    }
+
+    uint8_t mod;
+    if (rm.disp == 0 && (rm.base & 7) != RBP) {
+        mod = 0x00;
+    } else if (rm.disp >= -128 && rm.disp <= 127) {
+        mod = 0x40;
+    } else {
+        mod = 0x80;
+    }
+
+    if (rm.index >= 0 || (rm.base & 7) == RSP) {
+        emit8(jit, mod | (reg & 7) << 3 | 4);
+        emit8(jit, (rm.index >= 0 ? rm.index & 7 : 4) << 3 | (rm.base & 7));
+    } else {
+        emit8(jit, mod | (reg & 7) << 3 | (rm.base & 7));
+    }
+
+    if (mod == 0x40) {
+        emit8(jit, rm.disp & 0xff);
+    } else if (mod == 0x80) {
+        emit32(jit, rm.disp);
+    }
+}
+
+// 8 bit ALU operations, in the op r8, r/m8 form
+enum { ALU_ADD = 0x02, ALU_OR = 0x0a, ALU_ADC = 0x12, ALU_SBB = 0x1a, ALU_AND = 0x22, ALU_SUB = 0x2a, ALU_XOR = 0x32, ALU_CMP = 0x3a };
+
+static void emitAlu(jitCache * const jit, const uint8_t op, const int reg, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, op, -1, reg, rm);
+}
+
+static void emitAluImm(jitCache * const jit, const uint8_t op, const rmOperand rm, const uint8_t imm) {
+    // The 0x80 group uses the same ordering as the ALU opcodes
+    emitRM(jit, OP_BYTE, 0x80, -1, op >> 3, rm);
+    emit8(jit, imm);
+}
+
+static void emitLoad(jitCache * const jit, const int reg, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, 0x8a, -1, reg, rm);
+}
+
+static void emitStore(jitCache * const jit, const int reg, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, 0x88, -1, reg, rm);
+}
+
+static void emitStoreImm(jitCache * const jit, const rmOperand rm, const uint8_t imm) {
+    emitRM(jit, OP_BYTE, 0xc6, -1, 0, rm);
+    emit8(jit, imm);
+}
+
+static void emitMovImm(jitCache * const jit, const int reg, const uint32_t imm) {
+    if (reg & 8) emit8(jit, 0x41);
+    emit8(jit, 0xb8 + (reg & 7));
+    emit32(jit, imm);
+}
+
+static void emitMovImm8(jitCache * const jit, const int reg, const uint8_t imm) {
+    emit8(jit, reg & 8 ? 0x41 : 0x40);
+    emit8(jit, 0xb0 + (reg & 7));
+    emit8(jit, imm);
+}
+
+static void emitMovImm64(jitCache * const jit, const int reg, const uint64_t imm) {
+    emit8(jit, reg & 8 ? 0x49 : 0x48);
+    emit8(jit, 0xb8 + (reg & 7));
+    emit32(jit, imm & 0xffffffff);
+    emit32(jit, imm >> 32);
+}
+
+static void emitMovzx(jitCache * const jit, const int reg, const rmOperand rm) {
+    emitRM(jit, 0, 0x0f, 0xb6, reg, rm);
+}
+
+static void emitSetcc(jitCache * const jit, const int cc, const int reg) {
+    emitRM(jit, OP_BYTE, 0x0f, 0x90 + cc, 0, rmReg(reg));
+}
+
+static void emitTest(jitCache * const jit, const int reg, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, 0x84, -1, reg, rm);
+}
+
+static void emitTestImm(jitCache * const jit, const rmOperand rm, const uint8_t imm) {
+    emitRM(jit, OP_BYTE, 0xf6, -1, 0, rm);
+    emit8(jit, imm);
+}
+
+static void emitIncDec(jitCache * const jit, const bool dec, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, 0xfe, -1, dec, rm);
+}
+
+// Shift group /r values
+enum { SHIFT_RCL = 2, SHIFT_RCR = 3, SHIFT_SHL = 4, SHIFT_SHR = 5 };
+
+static void emitShift(jitCache * const jit, const int shift, const rmOperand rm) {
+    emitRM(jit, OP_BYTE, 0xd0, -1, shift, rm);
+}
+
+// Sets the host carry flag from the 6502 carry flag
+static void emitLoadCarry(jitCache * const jit) {
+    emitRM(jit, 0, 0x0f, 0xba, 4, rmReg(REG_C)); // bt r10d, 0
+    emit8(jit, 0);
+}
+
+static void emitAddCount(jitCache * const jit, const uint32_t count, const uint32_t cycleCount) {
+    if (count != 0) {
+        emitRM(jit, 0, 0x81, -1, 0, rmReg(REG_COUNT));
+        emit32(jit, count);
+    }
+
+    if (cycleCount != 0) {
+        emitRM(jit, OP_WIDE, 0x81, -1, 0, rmReg(REG_CYCLES));
+        emit32(jit, cycleCount);
+    }
+}
+
+static void emitJump(jitCache * const jit, const size_t target) {
+    emit8(jit, 0xe9);
+    emit32(jit, (uint32_t)(target - (jit->codeUsed + 4)));
+}
+
+static void emitJcc(jitCache * const jit, const int cc, const size_t target) {
+    emit8(jit, 0x0f);
+    emit8(jit, 0x80 + cc);
+    emit32(jit, (uint32_t)(target - (jit->codeUsed + 4)));
+}
+
+// Emits a short conditional jump to be patched by patchJump8
+static size_t emitJcc8(jitCache * const jit, const int cc) {
+    emit8(jit, 0x70 + cc);
+    emit8(jit, 0);
+    return jit->codeUsed;
+}
+
+static void patchJump8(jitCache * const jit, const size_t jump) {
+    jit->codeBuffer[jump - 1] = (uint8_t)(jit->codeUsed - jump);
+}
+
+static void emitNZ(jitCache * const jit, const int reg) {
+    emitTest(jit, reg, rmReg(reg));
+    emitSetcc(jit, CC_S, REG_N);
+    emitSetcc(jit, CC_Z, REG_Z);
+}
+
+static const uint8_t guestRegisters[] = { REG_AC, REG_X, REG_Y, REG_SP, REG_N, REG_V, REG_Z, REG_C };
+static const size_t guestRegisterOffsets[] = {
+    offsetof(jitState, AC), offsetof(jitState, X), offsetof(jitState, Y), offsetof(jitState, SP),
+    offsetof(jitState, negativeFlag), offsetof(jitState, overflowFlag), offsetof(jitState, zeroFlag), offsetof(jitState, carryFlag)
+};
+
+static const uint8_t savedRegisters[] = { RBX, RBP, R12, R13, R14, R15, RSI, RDI };
+
+// Shared by every block, writes the registers back to the jitState and returns the instruction count
+static void emitEpilogue(jitCache * const jit) {
+    for (size_t i = 0; i < sizeof guestRegisters; i++) {
+        emitStore(jit, guestRegisters[i], rmState(guestRegisterOffsets[i]));
+    }
+
+    emitRM(jit, OP_WIDE, 0x89, -1, REG_CYCLES, rmState(offsetof(jitState, cycles)));
+
+    emitRM(jit, 0, 0x89, -1, REG_COUNT, rmReg(RAX)); // mov eax, esi
+
+    for (size_t i = sizeof savedRegisters; i-- > 0;) {
+        if (savedRegisters[i] & 8) emit8(jit, 0x41);
+        emit8(jit, 0x58 + (savedRegisters[i] & 7));
+    }
+
+    emit8(jit, 0xc3);
+}
+
+static void emitPrologue(jitCache * const jit) {
+    for (size_t i = 0; i < sizeof savedRegisters; i++) {
+        if (savedRegisters[i] & 8) emit8(jit, 0x41);
+        emit8(jit, 0x50 + (savedRegisters[i] & 7));
+    }
+
+    emitRM(jit, OP_WIDE, 0x89, -1, REG_ARG, rmReg(REG_STATE));
+    emitRM(jit, OP_WIDE, 0x8b, -1, REG_MEM, rmState(offsetof(jitState, mem)));
+
+    for (size_t i = 0; i < sizeof guestRegisters; i++) {
+        emitMovzx(jit, guestRegisters[i], rmState(guestRegisterOffsets[i]));
+    }
+
+    emitRM(jit, 0, 0x31, -1, REG_COUNT, rmReg(REG_COUNT)); // xor esi, esi
+    emitRM(jit, 0, 0x31, -1, REG_CYCLES, rmReg(REG_CYCLES)); // xor edi, edi
+}
+
+static void emitExit(jitCache * const jit, const uint16_t pc, const uint32_t count, const uint32_t cycleCount) {
+    emitAddCount(jit, count, cycleCount);
+    emitRM(jit, OP_WORD, 0xc7, -1, 0, rmState(offsetof(jitState, PC)));
+    emit16(jit, pc);
+    emitJump(jit, jit->epilogueOffset);
+}
+
+// Branches back to the start of the block if the budget allows another pass
+static void emitLoopBack(jitCache * const jit, const uint16_t start, const size_t body, const uint32_t count, const uint32_t cycleCount) {
+    emitAddCount(jit, count, cycleCount);
+    emitRM(jit, 0, 0x3b, -1, REG_COUNT, rmState(offsetof(jitState, loopLimit)));
+    emitJcc(jit, CC_BE, body);
+    emitExit(jit, start, 0, 0);
+}
+
+// Leaves the block if the store to the address in eax hit a cached instruction,
+// so the interpreter can invalidate it before it runs
+static void emitCodeWriteCheck(jitCache * const jit, const uint8_t * const codeBitmap, const uint16_t nextPC, const uint32_t count, const uint32_t cycleCount) {
+    emitMovImm64(jit, RDX, (uint64_t)(uintptr_t)codeBitmap);
+    emitRM(jit, 0, 0x0f, 0xa3, RAX, rmMem(RDX, -1, 0)); // bt [rdx], eax
+    const size_t skip = emitJcc8(jit, CC_NC);
+    emitStoreImm(jit, rmState(offsetof(jitState, codeWritten)), 1);
+    emitRM(jit, OP_WORD, 0x89, -1, RAX, rmState(offsetof(jitState, codeWriteAddress)));
+    emitExit(jit, nextPC, count, cycleCount);
+    patchJump8(jit, skip);
+}
+
+// Whether the address a store goes to is only known when it runs
+static bool isRuntimeAddress(const uint8_t mode) {
+    return mode == MODE_ABSX || mode == MODE_ABSY || mode == MODE_INDX || mode == MODE_INDY;
+}
+
+// Marks the page the store to the address in eax goes to as written, for the rewind buffer
+static void emitPageWrite(jitCache * const jit, uint8_t * const writtenPages, const uint8_t mode, const uint16_t operand) {
+    if (isRuntimeAddress(mode)) {
+        emitRM(jit, 0, 0x89, -1, RAX, rmReg(RCX)); // mov ecx, eax
+        emitRM(jit, 0, 0xc1, -1, SHIFT_SHR, rmReg(RCX)); // shr ecx, 8
+        emit8(jit, 8);
+        emitMovImm64(jit, RDX, (uint64_t)(uintptr_t)writtenPages);
+        emitStoreImm(jit, rmMem(RDX, RCX, 0), 1);
+        return;
+    }
+
+    const uint8_t page = mode == MODE_ZPX || mode == MODE_ZPY ? 0 : operand >> 8;
+    emitMovImm64(jit, RDX, (uint64_t)(uintptr_t)&writtenPages[page]);
+    emitStoreImm(jit, rmMem(RDX, -1, 0), 1);
+}
+
+// Called by compiled stores to a device page, once the byte is in memory
+// cycles is what the block has run so far, so the device sees the cycle count the interpreter would give it
+// Returns nonzero if the block has to stop, because the device added cycles or moved the deadline
+static uint32_t jitWriteDevice(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte, const uint64_t cycles) {
+    cpu->cycles += cycles;
+    const uint64_t before = cpu->cycles;
+    const uint64_t deadline = cpu->deadline;
+    writeDevice(cpu, pointer, byte);
+    const bool stop = cpu->cycles != before || cpu->deadline != deadline;
+    cpu->cycles -= cycles;
+    return stop;
+}
+
+static const uint8_t callerSavedRegisters[] = { RSI, RDI, R8, R9, R10, R11, RAX };
+
+// Calls jitWriteDevice if the store of reg to the address in eax went to a device page
+// ecx is left nonzero if the block has to stop, returns false if the store can't reach a device
+static bool emitDeviceWrite(jitCache * const jit, cpu6502 * const cpu, const int reg, const uint8_t mode, const uint16_t operand, const uint32_t cycleCount) {
+    size_t skip = 0;
+    if (isRuntimeAddress(mode)) {
+        emitMovImm64(jit, RDX, (uint64_t)(uintptr_t)cpu->pages);
+        emitRM(jit, 0, 0x89, -1, RAX, rmReg(RCX)); // mov ecx, eax
+        emitRM(jit, 0, 0xc1, -1, SHIFT_SHR, rmReg(RCX)); // shr ecx, 8
+        emit8(jit, 8);
+        emitTestImm(jit, rmMem(RDX, RCX, 0), PAGE_WRITE);
+        emitMovImm(jit, RCX, 0); // Leaves the flags alone
+        skip = emitJcc8(jit, CC_Z);
+    } else if (mode != MODE_ABS || !isDevice(cpu, operand, PAGE_WRITE)) {
+        return false;
+    }
+
+    // The guest registers in caller saved host registers are kept on the stack, which is then 16 byte aligned
+    // 32 bytes are left below the arguments, the shadow space Windows needs
+    for (size_t i = 0; i < sizeof callerSavedRegisters; i++) {
+        if (callerSavedRegisters[i] & 8) emit8(jit, 0x41);
+        emit8(jit, 0x50 + (callerSavedRegisters[i] & 7));
+    }
+    emitRM(jit, OP_WIDE, 0x83, -1, 5, rmReg(RSP)); // sub rsp, 32
+    emit8(jit, 32);
+
+    #ifdef _WIN32
+    emitRM(jit, OP_WIDE, 0x8d, -1, R9, rmMem(REG_CYCLES, -1, cycleCount)); // lea r9, [rdi + cycleCount]
+    emitMovzx(jit, R8, rmReg(reg));
+    emitRM(jit, 0, 0x89, -1, RAX, rmReg(RDX)); // mov edx, eax
+    emitMovImm64(jit, RCX, (uint64_t)(uintptr_t)cpu);
+    #else
+    emitRM(jit, OP_WIDE, 0x8d, -1, RCX, rmMem(REG_CYCLES, -1, cycleCount)); // lea rcx, [rdi + cycleCount]
+    emitMovzx(jit, RDX, rmReg(reg));
+    emitRM(jit, 0, 0x89, -1, RAX, rmReg(RSI)); // mov esi, eax
+    emitMovImm64(jit, RDI, (uint64_t)(uintptr_t)cpu);
+    #endif
+
+    // ISO C doesn't allow casting function pointers to integers directly
+    const union {
+        uint32_t (*function)(cpu6502*, uint16_t, uint8_t, uint64_t);
+        void* pointer;
+    } helper = { .function = &jitWriteDevice };
+    emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)helper.pointer);
+    emitRM(jit, 0, 0xff, -1, 2, rmReg(RAX)); // call rax
+
+    emitRM(jit, OP_WIDE, 0x83, -1, 0, rmReg(RSP)); // add rsp, 32
+    emit8(jit, 32);
+    emitRM(jit, 0, 0x89, -1, RAX, rmReg(RCX)); // mov ecx, eax
+    for (size_t i = sizeof callerSavedRegisters; i-- > 0;) {
+        if (callerSavedRegisters[i] & 8) emit8(jit, 0x41);
+        emit8(jit, 0x58 + (callerSavedRegisters[i] & 7));
+    }
+
+    if (skip) patchJump8(jit, skip);
+    return true;
+}
+
+// Returns the operand for the byte the instruction reads or writes
+// Indexed addresses are calculated into eax, static addresses are also put in eax for stores
+// Indexed absolute reads add the page crossing cycle at runtime, indirect addresses are only compiled for stores
+static rmOperand emitOperand(jitCache * const jit, const uint8_t mode, const uint16_t operand, const bool store) {
+    switch (mode) {
+        // The pointer's high byte is read from the byte after the low byte, without wrapping in the zero page, as in readWord
+        case MODE_INDX:
+        emitMovzx(jit, RCX, rmReg(REG_X));
+        emitAluImm(jit, ALU_ADD, rmReg(RCX), operand & 0xff); // Wraps within the zero page
+        emitRM(jit, 0, 0x0f, 0xb7, RAX, rmMem(REG_MEM, RCX, 0)); // movzx eax, word [rbx + rcx]
+        return rmMem(REG_MEM, RAX, 0);
+
+        case MODE_INDY:
+        emitRM(jit, 0, 0x0f, 0xb7, RAX, rmMem(REG_MEM, -1, operand)); // movzx eax, word [rbx + operand]
+        emitMovzx(jit, RCX, rmReg(REG_Y));
+        emitRM(jit, 0, 0x01, -1, RCX, rmReg(RAX)); // add eax, ecx
+        emitRM(jit, 0, 0x0f, 0xb7, RAX, rmReg(RAX)); // movzx eax, ax
+        return rmMem(REG_MEM, RAX, 0);
+
+        case MODE_ZPX:
+        case MODE_ZPY:
+        emitMovzx(jit, RAX, rmReg(mode == MODE_ZPX ? REG_X : REG_Y));
+        emitAluImm(jit, ALU_ADD, rmReg(RAX), operand & 0xff); // Wraps within the zero page
+        return rmMem(REG_MEM, RAX, 0);
+
+        case MODE_ABSX:
+        case MODE_ABSY:
+        emitMovzx(jit, RAX, rmReg(mode == MODE_ABSX ? REG_X : REG_Y));
+        if (!store) {
+            // The page is crossed if adding the index to the low byte carries
+            emitRM(jit, 0, 0x8d, -1, RCX, rmMem(RAX, -1, operand & 0xff)); // lea ecx, [rax + low byte]
+            emitRM(jit, 0, 0xc1, -1, SHIFT_SHR, rmReg(RCX)); // shr ecx, 8
+            emit8(jit, 8);
+            emitRM(jit, OP_WIDE, 0x01, -1, RCX, rmReg(REG_CYCLES)); // add rdi, rcx
+        }
+        emitRM(jit, 0, 0x81, -1, 0, rmReg(RAX)); // add eax, operand
+        emit32(jit, operand);
+        emitRM(jit, 0, 0x0f, 0xb7, RAX, rmReg(RAX)); // movzx eax, ax
+        return rmMem(REG_MEM, RAX, 0);
+
+        default:
+        if (store) emitMovImm(jit, RAX, operand);
+        return rmMem(REG_MEM, -1, operand);
+    }
+}
+
+// Emits code for a load style instruction, which is either given an immediate or a memory operand
+// ADC and SBC load the 6502 carry after the address is calculated, since that changes the host flags
+static void emitAluOperand(jitCache * const jit, const uint8_t op, const int reg, const uint8_t mode, const uint16_t operand) {
+    const rmOperand rm = mode == MODE_IMM ? rmReg(reg) : emitOperand(jit, mode, operand, false);
+
+    if (op == ALU_ADC) {
+        emitLoadCarry(jit);
+    } else if (op == ALU_SBB) {
+        // The 6502 carry is the inverse of the x86 borrow
+        emitAluImm(jit, ALU_CMP, rmReg(REG_C), 1);
+    }
+
+    if (mode == MODE_IMM) {
+        emitAluImm(jit, op, rm, operand);
+    } else {
+        emitAlu(jit, op, reg, rm);
+    }
+}
+
+static int guestRegister(const uint8_t instruction) {
+    switch (instruction) {
+        case LDX: case STX: case CPX: return REG_X;
+        case LDY: case STY: case CPY: return REG_Y;
+        default: return REG_AC;
+    }
+}
+
+// Compilation
+
+static void flushJit(jitCache * const jit);
+
+static uint8_t* compileBlock(cpu6502 * const cpu, const uint16_t start) {
+    jitCache * const jit = cpu->jit;
+    const uint8_t * const mem = cpu->mem;
+
+    // Find the instructions in the block
+
+    uint16_t addresses[JIT_MAX_INSTRUCTIONS];
+    uint32_t count = 0;
+    uint16_t address = start;
+    bool usesDecimal = false;
+    bool endsWithJump = false;
+
+    while (count < JIT_MAX_INSTRUCTIONS) {
+        const uint8_t length = opcodeInfo[mem[address]].length;
+        if (address + length > 0x10000 || address + length - start > JIT_MAX_BLOCK_LENGTH) break;
+        if (!canCompile(cpu, address)) break;
+
+        const uint8_t instruction = opcodeInfo[mem[address]].instruction;
+        if (instruction == ADC || instruction == SBC) usesDecimal = true;
+
+        addresses[count++] = address;
+        address += length;
+
+        if (isBranch(instruction) || instruction == JMP) {
+            endsWithJump = true;
+            break;
+        }
+    }
+
+    if (count == 0) return NULL;
+
+    if (jit->codeUsed + JIT_MAX_BLOCK_SIZE > JIT_BUFFER_SIZE) flushJit(jit);
+
+    // Emit the code
+
+    uint8_t * const code = jit->codeBuffer + jit->codeUsed;
+
+    emitPrologue(jit);
+
+    if (usesDecimal) {
+        // Decimal mode is left to the interpreter, return without running anything
+        emitAluImm(jit, ALU_CMP, rmState(offsetof(jitState, decimalFlag)), 0);
+        emitJcc(jit, CC_NZ, jit->epilogueOffset);
+    }
+
+    const size_t body = jit->codeUsed;
+    uint32_t spent = 0; // Cycles used by the instructions so far, not counting page crossing
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint16_t pc = addresses[i];
+        const uint8_t opcode = mem[pc];
+        const uint8_t instruction = opcodeInfo[opcode].instruction;
+        const uint8_t mode = opcodeInfo[opcode].mode;
+        const uint8_t length = opcodeInfo[opcode].length;
+        const uint16_t operand = readOperand(mem, pc);
+        const uint16_t nextPC = pc + length;
+        const uint32_t ran = i + 1;
+        spent += opcodeInfo[opcode].cycles;
+        const int reg = guestRegister(instruction);
+
+        switch (instruction) {
+            case LDA: case LDX: case LDY:
+            if (mode == MODE_IMM) {
+                emitMovImm8(jit, reg, operand);
+            } else {
+                emitLoad(jit, reg, emitOperand(jit, mode, operand, false));
+            }
+            emitNZ(jit, reg);
+            break;
+
+            case STA: case STX: case STY: {
+                emitStore(jit, reg, emitOperand(jit, mode, operand, true));
+                emitPageWrite(jit, cpu->writtenPages, mode, operand);
+                const bool device = emitDeviceWrite(jit, cpu, reg, mode, operand, spent);
+                emitCodeWriteCheck(jit, cpu->codeBitmap, nextPC, ran, spent);
+                if (device) {
+                    emitRM(jit, 0, 0x85, -1, RCX, rmReg(RCX)); // test ecx, ecx
+                    const size_t carryOn = emitJcc8(jit, CC_Z);
+                    emitExit(jit, nextPC, ran, spent);
+                    patchJump8(jit, carryOn);
+                }
+                break;
+            }
+
+            case AND: case ORA: case EOR:
+            emitAluOperand(jit, instruction == AND ? ALU_AND : instruction == ORA ? ALU_OR : ALU_XOR, REG_AC, mode, operand);
+            emitNZ(jit, REG_AC);
+            break;
+
+            case ADC:
+            emitAluOperand(jit, ALU_ADC, REG_AC, mode, operand);
+            emitSetcc(jit, CC_C, REG_C);
+            emitSetcc(jit, CC_O, REG_V);
+            emitNZ(jit, REG_AC);
+            break;
+
+            case SBC:
+            emitAluOperand(jit, ALU_SBB, REG_AC, mode, operand);
+            emitSetcc(jit, CC_NC, REG_C);
+            emitSetcc(jit, CC_O, REG_V);
+            emitNZ(jit, REG_AC);
+            break;
+
+            case CMP: case CPX: case CPY:
+            emitAluOperand(jit, ALU_CMP, reg, mode, operand);
+            emitSetcc(jit, CC_NC, REG_C);
+            emitSetcc(jit, CC_Z, REG_Z);
+            emitSetcc(jit, CC_S, REG_N);
+            break;
+
+            case BIT:
+            emitLoad(jit, RCX, emitOperand(jit, mode, operand, false));
+            emitTest(jit, REG_AC, rmReg(RCX));
+            emitSetcc(jit, CC_Z, REG_Z);
+            emitTestImm(jit, rmReg(RCX), 0x80);
+            emitSetcc(jit, CC_NZ, REG_N);
+            emitTestImm(jit, rmReg(RCX), 0x40);
+            emitSetcc(jit, CC_NZ, REG_V);
+            break;
+
+            case INC: case DEC: {
+                const rmOperand rm = emitOperand(jit, mode, operand, true);
+                emitIncDec(jit, instruction == DEC, rm);
+                emitLoad(jit, RCX, rm);
+                emitNZ(jit, RCX);
+                emitPageWrite(jit, cpu->writtenPages, mode, operand);
+                emitCodeWriteCheck(jit, cpu->codeBitmap, nextPC, ran, spent);
+                break;
+            }
+
+            case ASL: case LSR: case ROL: case ROR: {
+                const rmOperand rm = emitOperand(jit, mode, operand, true);
+                if (instruction == ROL || instruction == ROR) emitLoadCarry(jit);
+                emitShift(jit, instruction == ASL ? SHIFT_SHL : instruction == LSR ? SHIFT_SHR : instruction == ROL ? SHIFT_RCL : SHIFT_RCR, rm);
+                emitSetcc(jit, CC_C, REG_C);
+                emitLoad(jit, RCX, rm);
+                emitNZ(jit, RCX);
+                emitPageWrite(jit, cpu->writtenPages, mode, operand);
+                emitCodeWriteCheck(jit, cpu->codeBitmap, nextPC, ran, spent);
+                break;
+            }
+
+            case ASLA: case LSRA: case ROLA: case RORA:
+            if (instruction == ROLA || instruction == RORA) emitLoadCarry(jit);
+            emitShift(jit, instruction == ASLA ? SHIFT_SHL : instruction == LSRA ? SHIFT_SHR : instruction == ROLA ? SHIFT_RCL : SHIFT_RCR, rmReg(REG_AC));
+            emitSetcc(jit, CC_C, REG_C);
+            emitNZ(jit, REG_AC);
+            break;
+
+            case INX: case INY: case DEX: case DEY: {
+                const int target = instruction == INX || instruction == DEX ? REG_X : REG_Y;
+                emitIncDec(jit, instruction == DEX || instruction == DEY, rmReg(target));
+                emitNZ(jit, target);
+                break;
+            }
+
+            case TAX: emitLoad(jit, REG_X, rmReg(REG_AC)); emitNZ(jit, REG_X); break;
+            case TAY: emitLoad(jit, REG_Y, rmReg(REG_AC)); emitNZ(jit, REG_Y); break;
+            case TXA: emitLoad(jit, REG_AC, rmReg(REG_X)); emitNZ(jit, REG_AC); break;
+            case TYA: emitLoad(jit, REG_AC, rmReg(REG_Y)); emitNZ(jit, REG_AC); break;
+            case TSX: emitLoad(jit, REG_X, rmReg(REG_SP)); emitNZ(jit, REG_X); break;
+            case TXS: emitLoad(jit, REG_SP, rmReg(REG_X)); break;
+
+            case CLC: emitMovImm(jit, REG_C, 0); break;
+            case SEC: emitMovImm(jit, REG_C, 1); break;
+            case CLV: emitMovImm(jit, REG_V, 0); break;
+            case NOP: break;
+
+            case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS: {
+                const int flag = instruction == BCC || instruction == BCS ? REG_C
+                               : instruction == BEQ || instruction == BNE ? REG_Z
+                               : instruction == BMI || instruction == BPL ? REG_N
+                               : REG_V;
+                const bool takenIfSet = instruction == BCS || instruction == BEQ || instruction == BMI || instruction == BVS;
+                const uint16_t target = nextPC + (int8_t)operand;
+                const uint32_t takenCycles = spent + ((nextPC ^ target) > 0xff ? 2 : 1);
+
+                emitTest(jit, flag, rmReg(flag));
+                const size_t notTaken = emitJcc8(jit, takenIfSet ? CC_Z : CC_NZ);
+                if (target == start) {
+                    emitLoopBack(jit, start, body, ran, takenCycles);
+                } else {
+                    emitExit(jit, target, ran, takenCycles);
+                }
+                patchJump8(jit, notTaken);
+                emitExit(jit, nextPC, ran, spent);
+                break;
+            }
+
+            case JMP:
+            if (operand == start) {
+                emitLoopBack(jit, start, body, ran, spent);
+            } else {
+                emitExit(jit, operand, ran, spent);
+            }
+            break;
+        }
+    }
+
+    if (!endsWithJump) emitExit(jit, address, count, spent);
+
+    // Mark the 6502 code so writes to it invalidate the block
+    for (uint16_t i = start; i != address; i++) {
+        jit->bitmap[i >> 3] |= 1 << (i & 7);
+        cpu->codeBitmap[i >> 3] |= 1 << (i & 7);
+    }
+
+    jit->blocks[start] = code;
+    jit->blockLengths[start] = address - start;
+    return code;
+}
+
+static void flushJit(jitCache * const jit) {
+    memset(jit->blocks, 0, sizeof jit->blocks);
+    memset(jit->heat, 0, sizeof jit->heat);
+    memset(jit->bitmap, 0, sizeof jit->bitmap);
+    jit->codeUsed = 0;
+    jit->epilogueOffset = jit->codeUsed;
+    emitEpilogue(jit);
+}
+
+void initJit(cpu6502 * const cpu) {
+    jitCache * const jit = calloc(1, sizeof(jitCache));
+    if (!jit) {
+        printf("Failed to allocate memory for the JIT\n");
+        exit(1);
+    }
+
+    #ifdef _WIN32
+    jit->codeBuffer = VirtualAlloc(NULL, JIT_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+    #else
+    jit->codeBuffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->codeBuffer == MAP_FAILED) jit->codeBuffer = NULL;
+    #endif
+
+    if (!jit->codeBuffer) {
+        printf("Failed to allocate executable memory for the JIT\n");
+        exit(1);
+    }
+
+    flushJit(jit);
+    cpu->jit = jit;
+}
+
+void destroyJit(cpu6502 * const cpu) {
+    jitCache * const jit = cpu->jit;
+    if (!jit) return;
+
+    #ifdef _WIN32
+    VirtualFree(jit->codeBuffer, 0, MEM_RELEASE);
+    #else
+    munmap(jit->codeBuffer, JIT_BUFFER_SIZE);
+    #endif
+
+    free(jit);
+    cpu->jit = NULL;
+}
+
+void resetJit(cpu6502 * const cpu) {
+    flushJit(cpu->jit);
+}
+
+void invalidateJit(cpu6502 * const cpu, const uint16_t pointer) {
+    jitCache * const jit = cpu->jit;
+    if (!(jit->bitmap[pointer >> 3] & (1 << (pointer & 7)))) return;
+
+    // Blocks are at most JIT_MAX_BLOCK_LENGTH bytes long,
+    // so only blocks starting shortly before pointer can cover it
+    for (uint32_t i = 0; i < JIT_MAX_BLOCK_LENGTH && i <= pointer; i++) {
+        const uint16_t start = pointer - i;
+        if (jit->blocks[start] && jit->blockLengths[start] > i) {
+            jit->blocks[start] = NULL;
+            // Self-modifying code would keep being recompiled, so leave it to the interpreter
+            jit->heat[start] = JIT_UNCOMPILABLE;
+        }
+    }
+
+    jit->bitmap[pointer >> 3] &= ~(1 << (pointer & 7));
+}
+
+uint32_t runJit(cpu6502 * const cpu, const uint32_t budget) {
+    // A block may run JIT_MAX_INSTRUCTIONS instructions before it can check the budget
+    if (budget < JIT_MAX_INSTRUCTIONS) return 0;
+
+    jitCache * const jit = cpu->jit;
+    const uint16_t PC = cpu->PC;
+    uint8_t* code = jit->blocks[PC];
+    if (!code) {
+        if (jit->heat[PC] == JIT_UNCOMPILABLE || ++jit->heat[PC] < JIT_THRESHOLD) return 0;
+
+        code = compileBlock(cpu, PC);
+        if (!code) {
+            jit->heat[PC] = JIT_UNCOMPILABLE;
+            return 0;
+        }
+    }
+
+    // Blocks keep each flag in its own byte
+    jitState state = {
+        .mem = cpu->mem,
+        .loopLimit = budget - JIT_MAX_INSTRUCTIONS,
+        .PC = PC,
+        .codeWritten = false,
+        .AC = cpu->AC,
+        .X = cpu->X,
+        .Y = cpu->Y,
+        .SP = cpu->SP,
+        .negativeFlag = getFlag(cpu, FLAG_NEGATIVE),
+        .overflowFlag = getFlag(cpu, FLAG_OVERFLOW),
+        .zeroFlag = getFlag(cpu, FLAG_ZERO),
+        .carryFlag = getFlag(cpu, FLAG_CARRY),
+        .decimalFlag = getFlag(cpu, FLAG_DECIMAL)
+    };
+
+    // ISO C doesn't allow casting data pointers to function pointers
+    const union {
+        uint8_t* code;
+        jitFunction function;
+    } block = { .code = code };
+
+    const uint32_t ran = block.function(&state);
+
+    cpu->PC = state.PC;
+    cpu->cycles += state.cycles;
+    cpu->AC = state.AC;
+    cpu->X = state.X;
+    cpu->Y = state.Y;
+    cpu->SP = state.SP;
+    setFlag(cpu, FLAG_NEGATIVE, state.negativeFlag);
+    setFlag(cpu, FLAG_OVERFLOW, state.overflowFlag);
+    setFlag(cpu, FLAG_ZERO, state.zeroFlag);
+    setFlag(cpu, FLAG_CARRY, state.carryFlag);
+
+    if (state.codeWritten) checkCodeWrite(cpu, state.codeWriteAddress);
+
+    return ran;
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#include <stdint.h>
+
+// Gives the CPU its own JIT cache, CPUs without one are only interpreted
+void initJit(cpu6502* cpu);
+void destroyJit(cpu6502* cpu);
+
+// Throws away every compiled block, for when the CPU's memory is replaced
+void resetJit(cpu6502* cpu);
+
+// Runs the compiled block at PC, compiling it first if it's hot enough
+// Returns the number of instructions run, which is at most budget,
+// or 0 if the instruction at PC should be interpreted instead
+uint32_t runJit(cpu6502* cpu, uint32_t budget);
+
+// Throws away any compiled blocks covering pointer, called when it's written to
+void invalidateJit(cpu6502* cpu, uint16_t pointer);
\ No newline at end of file
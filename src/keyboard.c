@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "emulate.h"
+#include "keyboard.h"
+#include "interrupts.h"
+
+// Keyboard input
+//
+// The window's key callback pushes keys into a ring buffer, and the CPU thread takes them out.
+// Only the CPU thread writes to memory, so keys aren't lost to a half finished instruction,
+// and the window thread never touches memory the CPU is using.
+//
+// Keys stay in the ring until the program reads them through the data register,
+// so the ring is also the FIFO the program sees. The registers are read straight from the ring,
+// but only up to the keys deliverKeys has let the program see, so keys always appear at a known point between instructions.
+//
+// That makes runs repeatable. A recording logs each key as deliverKeys shows it to the program,
+// as lines of "instructions queue key" for keys added to the queue and "instructions latch key" for the latch,
+// counting instructions from the start of the recording.
+// A replay shows the program the same keys after the same number of instructions instead of taking them from a window.
+// Instructions are counted rather than cycles since a run can always be stopped at an exact instruction,
+// while the delay register can take it past a cycle count.
+
+#define KEY_QUEUE_SIZE 64 // Must be a power of 2, and fit in bits 0-6 of the status register
+#define RECORDING_HEADER "6502 input recording"
+
+typedef struct {
+    uint64_t instructions;
+    uint16_t key;
+    bool queued; // Added to the queue, otherwise only latched
+} keyEvent;
+
+struct keyQueue {
+    uint16_t keys[KEY_QUEUE_SIZE];
+
+    // Count up forever and wrap, each is only written by one thread
+    // Kept on separate cache lines so pushing and popping don't contend
+    _Alignas(64) _Atomic uint32_t tail; // Written by the window thread
+    _Atomic uint32_t latest; // Newest key in the low 16 bits, and a count of key presses in the high 16 bits
+    _Alignas(64) _Atomic uint32_t head; // Written by the CPU thread
+    uint32_t latched; // CPU thread, latest when the latch was last written
+    uint32_t visible; // CPU thread, keys before this have been shown to the program
+
+    // Recording and replaying, CPU thread only
+    FILE* recording; // NULL unless recording
+    bool replaying; // Keys come from events rather than the window
+    uint64_t start; // The CPU's instruction count when recording or replaying started
+    keyEvent* events;
+    uint32_t eventCount;
+    uint32_t nextEvent;
+};
+
+keyQueue* createKeyQueue(void) {
+    keyQueue * const keys = calloc(1, sizeof(keyQueue));
+    if (!keys) {
+        printf("Failed to allocate memory for the key queue\n");
+        exit(1);
+    }
+    return keys;
+}
+
+void destroyKeyQueue(keyQueue * const keys) {
+    free(keys->events);
+    free(keys);
+}
+
+void pushKey(keyQueue * const keys, const uint16_t key) {
+    // The latch gets every key, even when the queue is full
+    const uint32_t presses = (atomic_load_explicit(&keys->latest, memory_order_relaxed) >> 16) + 1;
+    atomic_store_explicit(&keys->latest, presses << 16 | key, memory_order_release);
+
+    const uint32_t tail = atomic_load_explicit(&keys->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&keys->head, memory_order_acquire) == KEY_QUEUE_SIZE) return;
+
+    keys->keys[tail % KEY_QUEUE_SIZE] = key;
+    atomic_store_explicit(&keys->tail, tail + 1, memory_order_release);
+}
+
+static void setLatch(cpu6502 * const cpu, const uint16_t pointer, const uint8_t value) {
+    cpu->mem[pointer] = value;
+    checkCodeWrite(cpu, pointer);
+}
+
+static void latchKey(cpu6502 * const cpu, const uint16_t key) {
+    setLatch(cpu, KEY_LATCH, key & 0xff);
+    setLatch(cpu, KEY_LATCH + 1, key >> 8);
+    keyQueue * const keys = cpu->keys;
+    if (keys->recording) fprintf(keys->recording, "%llu latch %u\n", (unsigned long long)(cpu->instructions - keys->start), key);
+}
+
+// Replays are the only writer, so the CPU thread can add to the queue itself
+static void replayKeys(cpu6502 * const cpu) {
+    keyQueue * const keys = cpu->keys;
+    const uint32_t nextEvent = keys->nextEvent;
+    while (keys->nextEvent < keys->eventCount && keys->events[keys->nextEvent].instructions <= cpu->instructions - keys->start) {
+        const keyEvent * const event = &keys->events[keys->nextEvent++];
+        if (event->queued) {
+            const uint32_t tail = atomic_load_explicit(&keys->tail, memory_order_relaxed);
+            keys->keys[tail % KEY_QUEUE_SIZE] = event->key;
+            atomic_store_explicit(&keys->tail, tail + 1, memory_order_relaxed);
+            keys->visible = tail + 1;
+        } else {
+            latchKey(cpu, event->key);
+        }
+    }
+    if (keys->nextEvent != nextEvent) raiseInterrupt(cpu, INTERRUPT_KEYBOARD);
+}
+
+void deliverKeys(cpu6502 * const cpu) {
+    keyQueue * const keys = cpu->keys;
+    if (!keys) return;
+
+    if (keys->replaying) {
+        replayKeys(cpu);
+        return;
+    }
+
+    const uint32_t tail = atomic_load_explicit(&keys->tail, memory_order_acquire);
+    if (keys->recording) {
+        for (uint32_t i = keys->visible; i != tail; i++) {
+            fprintf(keys->recording, "%llu queue %u\n", (unsigned long long)(cpu->instructions - keys->start), keys->keys[i % KEY_QUEUE_SIZE]);
+        }
+    }
+    const bool queued = tail != keys->visible;
+    keys->visible = tail;
+
+    const uint32_t latest = atomic_load_explicit(&keys->latest, memory_order_acquire);
+    const bool latched = latest != keys->latched;
+    if (latched) {
+        keys->latched = latest;
+        latchKey(cpu, latest & 0xffff);
+    }
+    if (queued || latched) raiseInterrupt(cpu, INTERRUPT_KEYBOARD);
+}
+
+// Keys from head to visible can't be overwritten until the CPU thread moves head past them
+static uint8_t readKeyRegister(cpu6502 * const cpu, const uint16_t pointer) {
+    const keyQueue * const keys = cpu->keys;
+    const uint32_t head = atomic_load_explicit(&keys->head, memory_order_relaxed);
+    const uint32_t waiting = keys->visible - head;
+    const uint16_t key = waiting ? keys->keys[head % KEY_QUEUE_SIZE] : 0;
+
+    if (pointer == KEY_STATUS_REGISTER) return waiting | (key > 0xff ? 0x80 : 0);
+    return key & 0xff;
+}
+
+static void writeKeyData(cpu6502 * const cpu, const uint16_t pointer, const uint8_t byte) {
+    (void)pointer;
+    (void)byte;
+    keyQueue * const keys = cpu->keys;
+    const uint32_t head = atomic_load_explicit(&keys->head, memory_order_relaxed);
+    if (head != keys->visible) atomic_store_explicit(&keys->head, head + 1, memory_order_release);
+}
+
+void attachKeyQueue(cpu6502 * const cpu, keyQueue * const keys) {
+    cpu->keys = keys;
+    mapDevice(cpu, KEY_STATUS_REGISTER, KEY_DATA_REGISTER, &readKeyRegister, NULL);
+    mapDevice(cpu, KEY_DATA_REGISTER, KEY_DATA_REGISTER, NULL, &writeKeyData);
+}
+
+void startRecording(cpu6502 * const cpu, const char * const fileName) {
+    FILE * const file = fopen(fileName, "w");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    // The delay register's cycles depend on the clock rate, so the replay counts them the same way to end on the same cycle count
+    fprintf(file, "%s\nclock %llu\n", RECORDING_HEADER, (unsigned long long)cpu->clockRate);
+    cpu->keys->recording = file;
+    cpu->keys->start = cpu->instructions;
+}
+
+void stopRecording(cpu6502 * const cpu) {
+    FILE * const file = cpu->keys->recording;
+    fprintf(file, "end %llu\n", (unsigned long long)(cpu->instructions - cpu->keys->start));
+    if (fclose(file) != 0) {
+        printf("Failed to write recording\n");
+        exit(1);
+    }
+    cpu->keys->recording = NULL;
+}
+
+uint64_t loadReplay(cpu6502 * const cpu, const char * const fileName) {
+    FILE * const file = fopen(fileName, "r");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    keyQueue * const keys = cpu->keys;
+    uint32_t capacity = 0;
+    uint64_t end = 0;
+    bool ended = false;
+    char text[64];
+
+    for (uint32_t line = 1; fgets(text, sizeof text, file); line++) {
+        if (!strchr(text, '\n') && !feof(file)) {
+            printf("%s:%u: Line is too long\n", fileName, line);
+            exit(1);
+        }
+
+        unsigned long long count;
+        char type[8];
+        unsigned int key;
+        if (line == 1) {
+            if (strncmp(text, RECORDING_HEADER, strlen(RECORDING_HEADER)) != 0) {
+                printf("Not an input recording: %s\n", fileName);
+                exit(1);
+            }
+        } else if (sscanf(text, "clock %llu", &count) == 1) {
+            cpu->clockRate = count;
+        } else if (sscanf(text, "end %llu", &count) == 1) {
+            end = count;
+            ended = true;
+        } else if (sscanf(text, "%llu %7s %u", &count, type, &key) == 3 && key <= 0xffff
+            && (strcmp(type, "queue") == 0 || strcmp(type, "latch") == 0)) {
+            if (keys->eventCount == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                keys->events = realloc(keys->events, capacity * sizeof(keyEvent));
+                if (!keys->events) {
+                    printf("Failed to allocate memory for the recording\n");
+                    exit(1);
+                }
+            }
+            keys->events[keys->eventCount++] = (keyEvent){ .instructions = count, .key = key, .queued = type[0] == 'q' };
+        } else {
+            printf("%s:%u: Unexpected line: %s", fileName, line, text);
+            exit(1);
+        }
+    }
+    fclose(file);
+
+    // A recording cut short, e.g. by a crash, still replays as far as it goes
+    if (!ended) printf("%s: The recording has no end, replaying until the program halts\n", fileName);
+
+    keys->replaying = true;
+    keys->start = cpu->instructions;
+    return end;
+}
+
+uint64_t untilReplayKey(const cpu6502 * const cpu) {
+    const keyQueue * const keys = cpu->keys;
+    if (!keys || !keys->replaying || keys->nextEvent == keys->eventCount) return 0;
+    return keys->events[keys->nextEvent].instructions - (cpu->instructions - keys->start);
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+// Key presses are also latched at 0xFFF8 - 0xFFF9, the most recent key pressed
+#define KEY_STATUS_REGISTER 0xfff6 // Keys waiting in bits 0-6, bit 7 set if the first is a special key (high byte 1)
+#define KEY_DATA_REGISTER 0xfff7 // Low byte of the first key waiting, writing any value moves on to the next
+#define KEY_LATCH 0xfff8
+
+// Key presses passed from the window thread to the CPU thread
+// Single producer single consumer, so neither side takes a lock
+typedef struct keyQueue keyQueue;
+
+keyQueue* createKeyQueue(void);
+void destroyKeyQueue(keyQueue* keys);
+
+// Window thread only
+// Keys pressed while the queue is full are dropped
+void pushKey(keyQueue* keys, uint16_t key);
+
+// Gives the CPU a keyboard, mapping the key registers to the queue
+void attachKeyQueue(cpu6502* cpu, keyQueue* keys);
+
+// CPU thread only, between instructions
+// Shows the program the keys pushed since the last call, latching the newest, and raises the keyboard interrupt if there were any
+// When replaying, shows it the recorded keys that are due instead
+void deliverKeys(cpu6502* cpu);
+
+// Recordings log every key deliverKeys shows the program, with the number of instructions run before it was shown
+// stopRecording marks where the run ended, so the replay can stop at the same point
+void startRecording(cpu6502* cpu, const char* fileName);
+void stopRecording(cpu6502* cpu);
+
+// Replays a recording through the key queue, instead of keys from pushKey
+// Sets the CPU's clock rate to the recorded one, and returns the instructions the recording ran for, 0 if it's cut short
+uint64_t loadReplay(cpu6502* cpu, const char* fileName);
+
+// The instructions to run before the next recorded key is due, 0 if there are no more
+// Running exactly this many before calling deliverKeys shows the key at the same point as the recorded run
+uint64_t untilReplayKey(const cpu6502* cpu);
\ No newline at end of file
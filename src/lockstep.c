@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "emulate.h"
+#include "lockstep.h"
+#include "opcodeinfo.h"
+
+// Runs many copies of one program together, one byte lane per CPU
+//
+// Everything is kept as structure of arrays, so each register and each byte of memory
+// is a vector with one byte per lane, and one vector operation runs an instruction on every lane.
+// The compiler turns the vector operations into SSE, or AVX2 when it's enabled.
+//
+// This only works while every lane is running the same instruction on the same address.
+// Before an instruction runs, anything that decides the path or the address
+// (the instruction bytes, index registers, pointers, branch conditions, the stack pointer)
+// is checked against the leader, the lowest lane still in the group.
+// Lanes that disagree are copied out and carried on by the scalar core in emulate.c.
+// Instructions that aren't handled here, like device accesses, decimal mode and most illegal opcodes,
+// send every lane to the scalar core.
+//
+// The results must match the scalar core bit for bit, so each instruction here follows instructions.c
+
+#if !defined(__GNUC__)
+#error "Lockstep execution requires GCC or Clang vector extensions"
+#endif
+
+#define MIN_LANES 2 // Below this, the scalar core is faster
+
+typedef uint8_t laneVector __attribute__((vector_size(LOCKSTEP_LANES)));
+typedef int8_t laneMask __attribute__((vector_size(LOCKSTEP_LANES))); // Result of comparing vectors, 0 or -1 per lane
+
+struct lockstepGroup {
+    laneVector mem[0x10000];
+    laneVector AC;
+    laneVector X;
+    laneVector Y;
+    laneVector SP;
+
+    // Flags, each 0 or 1
+    laneVector N;
+    laneVector V;
+    laneVector D;
+    laneVector I;
+    laneVector Z;
+    laneVector C;
+
+    laneVector inactive; // 0xff for lanes that have left the group
+    uint32_t active; // Bit per lane still in the group
+    uint64_t cycles;
+    uint16_t PC;
+    uint16_t prevPC; // Used to detect infinite loops
+
+    uint8_t image[0x10000]; // Scratch space for copying a lane out
+};
+
+// Where ejected lanes go, and how far through runLockstep they got
+typedef struct {
+    lockstepGroup* group;
+    cpu6502* cpu;
+    lockstepExit exit;
+    void* context;
+    uint32_t ran;
+} laneExit;
+
+static inline laneVector splat(const uint8_t value) {
+    return (laneVector){ 0 } + value;
+}
+
+// 1 where the mask is set, 0 elsewhere
+#define fromMask(mask) ((laneVector)(mask) & 1)
+
+static inline bool allSet(const laneVector * const vector) {
+    uint64_t words[LOCKSTEP_LANES / 8];
+    memcpy(words, vector, sizeof words);
+
+    uint64_t all = ~0ULL;
+    for (uint32_t i = 0; i < LOCKSTEP_LANES / 8; i++) all &= words[i];
+    return all == ~0ULL;
+}
+
+static inline uint32_t getLeader(const lockstepGroup * const group) {
+    return __builtin_ctz(group->active);
+}
+
+static inline uint8_t packStatus(const lockstepGroup * const group, const uint32_t lane) {
+    return group->N[lane] << 7 | group->V[lane] << 6 | group->D[lane] << 3 | group->I[lane] << 2 | group->Z[lane] << 1 | group->C[lane];
+}
+
+static inline laneVector packStatusVector(const lockstepGroup * const group) {
+    return group->N << 7 | group->V << 6 | group->D << 3 | group->I << 2 | group->Z << 1 | group->C;
+}
+
+static inline void unpackStatusVector(lockstepGroup * const group, const laneVector * const status) {
+    group->N = *status >> 7;
+    group->V = (*status >> 6) & 1;
+    group->D = (*status >> 3) & 1;
+    group->I = (*status >> 2) & 1;
+    group->Z = (*status >> 1) & 1;
+    group->C = *status & 1;
+}
+
+static inline void setZeroNegative(lockstepGroup * const group, const laneVector * const value) {
+    group->Z = fromMask(*value == 0);
+    group->N = *value >> 7;
+}
+
+// Copies a lane into the scalar CPU and hands it to the exit callback
+static void ejectLane(const laneExit * const exit, const uint32_t lane, const bool halted) {
+    lockstepGroup * const group = exit->group;
+    cpu6502 * const cpu = exit->cpu;
+
+    for (uint32_t address = 0; address < 0x10000; address++) group->image[address] = group->mem[address][lane];
+    resetCpu(cpu, group->image);
+
+    cpu->cycles = group->cycles;
+    cpu->PC = group->PC;
+    cpu->SP = group->SP[lane];
+    cpu->AC = group->AC[lane];
+    cpu->X = group->X[lane];
+    cpu->Y = group->Y[lane];
+    setStatus(cpu, packStatus(group, lane));
+    if (halted) haltCpu(cpu);
+
+    group->active &= ~(1U << lane);
+    group->inactive[lane] = 0xff;
+
+    exit->exit(exit->context, lane, cpu, exit->ran);
+}
+
+static void ejectAll(const laneExit * const exit, const bool halted) {
+    while (exit->group->active) ejectLane(exit, getLeader(exit->group), halted);
+}
+
+// Ejects the lanes where vector differs from the leader
+// Returns false if too few lanes are left to carry on, in which case they've all been ejected
+static bool keepUniform(const laneExit * const exit, const laneVector * const vector) {
+    lockstepGroup * const group = exit->group;
+    const uint32_t leader = getLeader(group);
+    const laneMask same = *vector == splat((*vector)[leader]);
+    const laneVector kept = (laneVector)same | group->inactive;
+    if (allSet(&kept)) return true;
+
+    for (uint32_t lane = leader + 1; lane < LOCKSTEP_LANES; lane++) {
+        if ((group->active & (1U << lane)) && !same[lane]) ejectLane(exit, lane, false);
+    }
+
+    if (__builtin_popcount(group->active) < MIN_LANES) {
+        ejectAll(exit, false);
+        return false;
+    }
+    return true;
+}
+
+// The stack can only be used while SP is the same in every lane
+static inline void push(lockstepGroup * const group, const laneVector * const value) {
+    const uint8_t SP = group->SP[getLeader(group)];
+    group->mem[0x100 + SP] = *value;
+    group->SP = splat(SP - 1);
+}
+
+static inline laneVector pull(lockstepGroup * const group) {
+    const uint8_t SP = group->SP[getLeader(group)] + 1;
+    group->SP = splat(SP);
+    return group->mem[0x100 + SP];
+}
+
+// Return addresses are the same in every lane, as PC is
+static inline void pushAddress(lockstepGroup * const group, const uint16_t address) {
+    const laneVector hi = splat(address >> 8);
+    const laneVector lo = splat(address & 0xff);
+    push(group, &hi);
+    push(group, &lo);
+}
+
+static inline void pushStatus(lockstepGroup * const group) {
+    const laneVector status = packStatusVector(group) | FLAG_UNUSED | FLAG_BREAK;
+    push(group, &status);
+}
+
+static inline void pullStatus(lockstepGroup * const group) {
+    const laneVector status = pull(group);
+    unpackStatusVector(group, &status);
+}
+
+// Reads a 16 bit value from memory as readWord does, ejecting lanes where it's different
+static bool readUniformWord(const laneExit * const exit, const uint16_t lo, const uint16_t hi, uint16_t * const word) {
+    lockstepGroup * const group = exit->group;
+    if (!keepUniform(exit, &group->mem[lo]) || !keepUniform(exit, &group->mem[hi])) return false;
+
+    const uint32_t leader = getLeader(group);
+    *word = group->mem[hi][leader] << 8 | group->mem[lo][leader];
+    return true;
+}
+
+static inline bool isStackInstruction(const uint8_t instruction) {
+    switch (instruction) {
+        case PHA: case PHP: case PLA: case PLP: case JSR: case RTS: case RTI: case BRK:
+        return true;
+
+        default:
+        return false;
+    }
+}
+
+static inline bool isMemoryWrite(const uint8_t instruction, const uint8_t mode) {
+    switch (instruction) {
+        case STA: case STX: case STY:
+        return true;
+
+        case INC: case DEC: case ASL: case LSR: case ROL: case ROR:
+        return mode != MODE_IMP;
+
+        default:
+        return false;
+    }
+}
+
+static inline bool isMemoryRead(const uint8_t instruction, const uint8_t mode) {
+    switch (instruction) {
+        case STA: case STX: case STY: case JMP: case JSR:
+        return false;
+
+        default:
+        return mode != MODE_IMP && mode != MODE_IMM && mode != MODE_REL;
+    }
+}
+
+static inline bool isSupported(const uint8_t instruction) {
+    switch (instruction) {
+        case ALR: case ANC: case ANE: case ARR: case DCP: case ISC: case JAM: case LAS: case LAX: case LXA:
+        case RLA: case RRA: case SAX: case SBX: case SHA: case SHX: case SHY: case SLO: case SRE: case TAS:
+        return false;
+
+        default:
+        return true;
+    }
+}
+
+// ADC without decimal mode, SBC adds the inverted operand
+static inline void addWithCarry(lockstepGroup * const group, const laneVector * const value) {
+    const laneVector sum = group->AC + *value;
+    const laneVector result = sum + group->C;
+    group->C = fromMask(sum < group->AC) | fromMask(result < sum);
+    group->V = ((group->AC ^ result) & (*value ^ result)) >> 7;
+    group->AC = result;
+    setZeroNegative(group, &result);
+}
+
+static inline void compare(lockstepGroup * const group, const laneVector * const reg, const laneVector * const value) {
+    group->C = fromMask(*reg >= *value);
+    group->Z = fromMask(*reg == *value);
+    group->N = (laneVector)(*reg - *value) >> 7;
+}
+
+// Runs the instruction at PC on every lane, or ejects the lanes that can't run it
+// Returns false if every lane has left the group
+static bool step(const laneExit * const exit) {
+    lockstepGroup * const group = exit->group;
+    const uint16_t pc = group->PC;
+
+    // Every lane has to be running the same instruction
+
+    if (!keepUniform(exit, &group->mem[pc])) return false;
+    const uint8_t opcode = group->mem[pc][getLeader(group)];
+    const uint8_t instruction = opcodeInfo[opcode].instruction;
+    const uint8_t mode = opcodeInfo[opcode].mode;
+    const uint8_t length = opcodeInfo[opcode].length;
+
+    if (!isSupported(instruction)) {
+        ejectAll(exit, false);
+        return false;
+    }
+
+    uint16_t operand = 0;
+    if (length > 1) {
+        if (!keepUniform(exit, &group->mem[(uint16_t)(pc + 1)])) return false;
+        operand = group->mem[(uint16_t)(pc + 1)][getLeader(group)];
+    }
+    if (length > 2) {
+        if (!keepUniform(exit, &group->mem[(uint16_t)(pc + 2)])) return false;
+        operand |= group->mem[(uint16_t)(pc + 2)][getLeader(group)] << 8;
+    }
+
+    // Work out the address, which has to be the same in every lane
+
+    uint16_t address = 0;
+    bool pageCrossed = false;
+
+    switch (mode) {
+        case MODE_IMP:
+        break;
+
+        case MODE_IMM:
+        case MODE_REL:
+        address = pc + 1;
+        break;
+
+        case MODE_ZP:
+        case MODE_ABS:
+        address = operand;
+        break;
+
+        case MODE_ZPX:
+        case MODE_ZPY: {
+            const laneVector * const index = mode == MODE_ZPX ? &group->X : &group->Y;
+            if (!keepUniform(exit, index)) return false;
+            address = (operand + (*index)[getLeader(group)]) & 0xff;
+            break;
+        }
+
+        case MODE_ABSX:
+        case MODE_ABSY: {
+            const laneVector * const index = mode == MODE_ABSX ? &group->X : &group->Y;
+            if (!keepUniform(exit, index)) return false;
+            address = operand + (*index)[getLeader(group)];
+            pageCrossed = (operand ^ address) > 0xff;
+            break;
+        }
+
+        case MODE_IND:
+        // Keeps the bug where a vector at xxFF reads its high byte from xx00
+        if (!readUniformWord(exit, operand, (operand & 0xff) == 0xff ? operand & 0xff00 : operand + 1, &address)) return false;
+        break;
+
+        case MODE_INDX: {
+            if (!keepUniform(exit, &group->X)) return false;
+            const uint16_t pointer = (operand + group->X[getLeader(group)]) & 0xff;
+            if (!readUniformWord(exit, pointer, pointer + 1, &address)) return false;
+            break;
+        }
+
+        case MODE_INDY: {
+            uint16_t base;
+            if (!readUniformWord(exit, operand, operand + 1, &base)) return false;
+            if (!keepUniform(exit, &group->Y)) return false;
+            address = base + group->Y[getLeader(group)];
+            pageCrossed = (base ^ address) > 0xff;
+            break;
+        }
+    }
+
+    // Anything else that decides what happens has to be the same in every lane too
+
+    const uint8_t access = (isMemoryRead(instruction, mode) ? PAGE_READ : 0) | (isMemoryWrite(instruction, mode) ? PAGE_WRITE : 0);
+    if (access && isDevice(exit->cpu, address, access)) {
+        // Devices, like console and delay output, are left to the scalar core
+        ejectAll(exit, false);
+        return false;
+    }
+
+    if (isStackInstruction(instruction) && !keepUniform(exit, &group->SP)) return false;
+
+    if (instruction == ADC || instruction == SBC) {
+        if (!keepUniform(exit, &group->D)) return false;
+        if (group->D[getLeader(group)]) {
+            ejectAll(exit, false);
+            return false;
+        }
+    }
+
+    uint16_t target = 0; // For instructions that change PC
+    switch (instruction) {
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS: {
+            const laneVector * const flag = instruction == BCC || instruction == BCS ? &group->C
+                                          : instruction == BEQ || instruction == BNE ? &group->Z
+                                          : instruction == BMI || instruction == BPL ? &group->N
+                                          : &group->V;
+            const bool takenIfSet = instruction == BCS || instruction == BEQ || instruction == BMI || instruction == BVS;
+            if (!keepUniform(exit, flag)) return false;
+            target = pc + 2;
+            if ((*flag)[getLeader(group)] == takenIfSet) {
+                const uint16_t next = target;
+                target = next + (int8_t)operand;
+                group->cycles += (next ^ target) > 0xff ? 2 : 1;
+            }
+            break;
+        }
+
+        case RTS:
+        case RTI: {
+            const uint8_t SP = group->SP[getLeader(group)] + (instruction == RTI);
+            if (!readUniformWord(exit, 0x100 + (uint8_t)(SP + 1), 0x100 + (uint8_t)(SP + 2), &target)) return false;
+            break;
+        }
+
+        case BRK:
+        if (!readUniformWord(exit, 0xfffe, 0xffff, &target)) return false;
+        break;
+    }
+
+    // Every lane agrees, run the instruction
+
+    group->cycles += opcodeInfo[opcode].cycles;
+    if (opcodeInfo[opcode].page && pageCrossed) group->cycles++;
+
+    laneVector * const memory = &group->mem[address];
+    uint16_t nextPC = pc + length;
+
+    switch (instruction) {
+        case ADC: addWithCarry(group, memory); break;
+        case SBC: {
+            const laneVector inverted = ~*memory;
+            addWithCarry(group, &inverted);
+            break;
+        }
+
+        case AND: group->AC &= *memory; setZeroNegative(group, &group->AC); break;
+        case ORA: group->AC |= *memory; setZeroNegative(group, &group->AC); break;
+        case EOR: group->AC ^= *memory; setZeroNegative(group, &group->AC); break;
+
+        case LDA: group->AC = *memory; setZeroNegative(group, &group->AC); break;
+        case LDX: group->X = *memory; setZeroNegative(group, &group->X); break;
+        case LDY: group->Y = *memory; setZeroNegative(group, &group->Y); break;
+
+        case STA: *memory = group->AC; break;
+        case STX: *memory = group->X; break;
+        case STY: *memory = group->Y; break;
+
+        case CMP: compare(group, &group->AC, memory); break;
+        case CPX: compare(group, &group->X, memory); break;
+        case CPY: compare(group, &group->Y, memory); break;
+
+        case BIT: {
+            const laneVector value = *memory;
+            group->Z = fromMask((group->AC & value) == 0);
+            group->V = (value >> 6) & 1;
+            group->N = value >> 7;
+            break;
+        }
+
+        case INC: *memory += 1; setZeroNegative(group, memory); break;
+        case DEC: *memory -= 1; setZeroNegative(group, memory); break;
+
+        case ASL: case ASLA: {
+            laneVector * const value = instruction == ASLA ? &group->AC : memory;
+            group->C = *value >> 7;
+            *value <<= 1;
+            setZeroNegative(group, value);
+            break;
+        }
+
+        case LSR: case LSRA: {
+            laneVector * const value = instruction == LSRA ? &group->AC : memory;
+            group->C = *value & 1;
+            *value >>= 1;
+            setZeroNegative(group, value);
+            break;
+        }
+
+        case ROL: case ROLA: {
+            laneVector * const value = instruction == ROLA ? &group->AC : memory;
+            const laneVector carry = *value >> 7;
+            *value = *value << 1 | group->C;
+            group->C = carry;
+            setZeroNegative(group, value);
+            break;
+        }
+
+        case ROR: case RORA: {
+            laneVector * const value = instruction == RORA ? &group->AC : memory;
+            const laneVector carry = *value & 1;
+            *value = *value >> 1 | group->C << 7;
+            group->C = carry;
+            setZeroNegative(group, value);
+            break;
+        }
+
+        case INX: group->X += 1; setZeroNegative(group, &group->X); break;
+        case INY: group->Y += 1; setZeroNegative(group, &group->Y); break;
+        case DEX: group->X -= 1; setZeroNegative(group, &group->X); break;
+        case DEY: group->Y -= 1; setZeroNegative(group, &group->Y); break;
+
+        case TAX: group->X = group->AC; setZeroNegative(group, &group->X); break;
+        case TAY: group->Y = group->AC; setZeroNegative(group, &group->Y); break;
+        case TXA: group->AC = group->X; setZeroNegative(group, &group->AC); break;
+        case TYA: group->AC = group->Y; setZeroNegative(group, &group->AC); break;
+        case TSX: group->X = group->SP; setZeroNegative(group, &group->X); break;
+        case TXS: group->SP = group->X; break;
+
+        case CLC: group->C = splat(0); break;
+        case SEC: group->C = splat(1); break;
+        case CLD: group->D = splat(0); break;
+        case SED: group->D = splat(1); break;
+        case CLI: group->I = splat(0); break;
+        case SEI: group->I = splat(1); break;
+        case CLV: group->V = splat(0); break;
+
+        case NOP: case DOP: case TOP: break;
+
+        case PHA: push(group, &group->AC); break;
+        case PHP: pushStatus(group); break;
+        case PLA: group->AC = pull(group); setZeroNegative(group, &group->AC); break;
+        case PLP: pullStatus(group); break;
+
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+        nextPC = target;
+        break;
+
+        case JMP:
+        nextPC = address;
+        break;
+
+        case JSR:
+        pushAddress(group, pc + 2);
+        nextPC = address;
+        break;
+
+        case RTS:
+        pull(group);
+        pull(group);
+        nextPC = target + 1;
+        break;
+
+        case RTI:
+        pullStatus(group);
+        pull(group);
+        pull(group);
+        nextPC = target;
+        break;
+
+        case BRK:
+        pushAddress(group, pc + 2);
+        pushStatus(group);
+        group->I = splat(1);
+        nextPC = target;
+        break;
+    }
+
+    group->PC = nextPC;
+    return true;
+}
+
+lockstepGroup* createLockstep(void) {
+    // Vectors have to be aligned to their size, which can be more than malloc guarantees
+    #ifdef _WIN32
+    lockstepGroup * const group = _aligned_malloc(sizeof(lockstepGroup), _Alignof(lockstepGroup));
+    #else
+    lockstepGroup * const group = aligned_alloc(_Alignof(lockstepGroup), sizeof(lockstepGroup));
+    #endif
+    if (!group) {
+        printf("Failed to allocate memory for the lockstep group\n");
+        exit(1);
+    }
+    return group;
+}
+
+void destroyLockstep(lockstepGroup * const group) {
+    #ifdef _WIN32
+    _aligned_free(group);
+    #else
+    free(group);
+    #endif
+}
+
+void resetLockstep(lockstepGroup * const group, const uint8_t * const image, const uint32_t laneCount) {
+    for (uint32_t address = 0; address < 0x10000; address++) group->mem[address] = splat(image[address]);
+
+    group->AC = splat(0);
+    group->X = splat(0);
+    group->Y = splat(0);
+    group->SP = splat(0xff);
+    group->N = splat(0);
+    group->V = splat(0);
+    group->D = splat(0);
+    group->I = splat(0);
+    group->Z = splat(0);
+    group->C = splat(0);
+
+    group->active = laneCount >= 32 ? ~0U : (1U << laneCount) - 1;
+    for (uint32_t lane = 0; lane < LOCKSTEP_LANES; lane++) group->inactive[lane] = lane < laneCount ? 0 : 0xff;
+
+    group->cycles = 0;
+    group->PC = image[0xfffd] << 8 | image[0xfffc];
+    group->prevPC = ~group->PC;
+}
+
+void pokeLockstep(lockstepGroup * const group, const uint32_t lane, const uint16_t address, const uint8_t value) {
+    group->mem[address][lane] = value;
+}
+
+uint32_t runLockstep(lockstepGroup * const group, const uint32_t count, cpu6502 * const cpu, const lockstepExit exit, void * const context) {
+    laneExit lanes = { .group = group, .cpu = cpu, .exit = exit, .context = context };
+
+    for (lanes.ran = 0; lanes.ran < count; lanes.ran++) {
+        if (!group->active) return lanes.ran;
+
+        // An instruction that jumps to itself halts every lane, as it does the scalar core
+        if (group->PC == group->prevPC) {
+            ejectAll(&lanes, true);
+            return lanes.ran;
+        }
+        group->prevPC = group->PC;
+
+        if (!step(&lanes)) return lanes.ran;
+    }
+
+    return count;
+}
+
+void finishLockstep(lockstepGroup * const group, cpu6502 * const cpu, const lockstepExit exit, void * const context) {
+    const laneExit lanes = { .group = group, .cpu = cpu, .exit = exit, .context = context, .ran = 0 };
+    ejectAll(&lanes, false);
+}
+
+bool isLockstepEmpty(const lockstepGroup * const group) {
+    return group->active == 0;
+}
+
+uint64_t getLockstepCycles(const lockstepGroup * const group) {
+    return group->cycles;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// One byte per lane fills a vector register, AVX2 if the compiler is allowed to use it or SSE2 otherwise
+// Wider vectors than the target supports get split into single bytes, which is slower than not using lockstep
+#ifdef __AVX2__
+#define LOCKSTEP_LANES 32
+#else
+#define LOCKSTEP_LANES 16
+#endif
+
+// A group of CPUs running the same program together, one per lane
+typedef struct lockstepGroup lockstepGroup;
+
+// Called when a lane leaves the group, with the lane copied into cpu
+// ran is the number of instructions the lane ran in the current runLockstep call
+typedef void (*lockstepExit)(void* context, uint32_t lane, cpu6502* cpu, uint32_t ran);
+
+lockstepGroup* createLockstep(void);
+void destroyLockstep(lockstepGroup* group);
+
+// Loads image into the first laneCount lanes and resets their registers, as resetCpu does
+void resetLockstep(lockstepGroup* group, const uint8_t* image, uint32_t laneCount);
+
+// Changes one byte of one lane's memory, to give each lane different inputs
+void pokeLockstep(lockstepGroup* group, uint32_t lane, uint16_t address, uint8_t value);
+
+// Runs up to count instructions on every lane at once
+// Lanes that branch differently, or reach something that can't be run in lockstep,
+// are copied into cpu and passed to exit, which should carry on running them
+// Returns the number of instructions run, which is less than count if every lane has left
+uint32_t runLockstep(lockstepGroup* group, uint32_t count, cpu6502* cpu, lockstepExit exit, void* context);
+
+// Passes every lane still in the group to exit
+void finishLockstep(lockstepGroup* group, cpu6502* cpu, lockstepExit exit, void* context);
+
+bool isLockstepEmpty(const lockstepGroup* group);
+
+// Every lane in the group has run the same number of cycles
+uint64_t getLockstepCycles(const lockstepGroup* group);
\ No newline at end of file
@@ -1,46 +1,391 @@
+#define _POSIX_C_SOURCE 200809L // For fileno
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef HEADLESS
 #include <GLEW/glew.h>
 #include <GLFW/glfw3.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#endif
 #include "emulate.h"
+#ifndef HEADLESS
 #include "display.h"
+#endif
 #include "instructions.h"
+#include "governor.h"
+#include "framebuffer.h"
+#include "keyboard.h"
+#include "console.h"
+#include "batch.h"
+#include "headless.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "image.h"
+#ifdef JIT
+#include "jit.h"
+#endif
+
+#ifndef HEADLESS
+
+#define IDLE_FRAME_TIME (1.0 / 60.0) // Seconds between checks for screen changes when nothing is being drawn
+#define REWIND_KEY GLFW_KEY_F9 // Held down to go back through the history
+
+static rewindBuffer* history;
+static atomic_uint rewindSteps; // Presses of the rewind key the CPU thread hasn't acted on yet
 
 static void keyCallback(GLFWwindow* callbackWindow, int key, int scancode, int action, int mods) {
     // Compiler warns about unused parameters
     // Cast to void to ignore them
-    (void)callbackWindow;
     (void)scancode;
     (void)mods;
 
+    // The rewind key is for the emulator rather than the program, and repeats while it's held
+    if (key == REWIND_KEY) {
+        if (action != GLFW_RELEASE) {
+            atomic_fetch_add(&rewindSteps, 1);
+            wakeGovernor();
+        }
+        return;
+    }
+
+    // The CPU thread writes the key to memory between instructions
     if (action == GLFW_PRESS) {
-        mem[0xfff8] = key & 0xff;
-        mem[0xfff9] = (key >> 8) & 0xff;
+        const cpu6502 * const cpu = glfwGetWindowUserPointer(callbackWindow);
+        pushKey(cpu->keys, key);
+        wakeGovernor();
     }
 }
 
+static bool redraw = false; // Set when the window needs drawing again without a new frame
+
+// Called from glfwPollEvents, on the main thread
+static void refreshCallback(GLFWwindow* callbackWindow) {
+    (void)callbackWindow;
+    redraw = true;
+}
+
 static void* emulate(void* args) {
-    (void)args;
+    cpu6502 * const cpu = args;
 
-    while (!glfwWindowShouldClose(window)) runInstruction();
+    // The governor runs the CPU it was given, the CPU stops by itself if it halts
+    // The thread keeps going after that, since the history can still be rewound to
+    bool shown = false;
+    while (!glfwWindowShouldClose(window)) {
+        uint32_t steps = atomic_exchange(&rewindSteps, 0);
+        if (steps && history) {
+            while (steps-- && stepBack(history, cpu)) {}
+            resyncGovernor();
+            presentFrame(cpu); // Even if the program presents manually, it should be seen going back
+            shown = true;
+        }
 
+        if (cpu->halted) {
+            // Show where it stopped
+            if (!shown) endFrame(cpu);
+            shown = true;
+            parkGovernor();
+            continue;
+        }
+
+        runSlice();
+        deliverKeys(cpu);
+        if (history) recordRewind(history, cpu);
+        shown = false;
+    }
     return NULL;
 }
 
+#endif
+
+// Parses a clock rate given in MHz, 0 for unlimited
+static uint64_t parseClockRate(const char * const string) {
+    char* end;
+    const double megahertz = strtod(string, &end);
+    const double rate = megahertz * 1000000.0 + 0.5;
+
+    if (end == string || *end != '\0' || !(rate >= 0.0) || rate > (double)MAX_CLOCK_RATE) {
+        printf("Invalid clock rate: %s\n", string);
+        exit(1);
+    }
+
+    return (uint64_t)rate;
+}
+
+static uint32_t parseThreadCount(const char * const string) {
+    char* end;
+    const unsigned long count = strtoul(string, &end, 10);
+
+    if (end == string || *end != '\0' || string[0] == '-' || count > 1024) {
+        printf("Invalid thread count: %s\n", string);
+        exit(1);
+    }
+
+    return count;
+}
+
+static uint64_t parseLimit(const char * const string) {
+    char* end;
+    const unsigned long long limit = strtoull(string, &end, 10);
+
+    if (end == string || *end != '\0' || string[0] == '-') {
+        printf("Invalid limit: %s\n", string);
+        exit(1);
+    }
+
+    return limit;
+}
+
+// newline, size=bytes or time=milliseconds, the number being optional
+static flushPolicy parseFlushPolicy(const char * const string, uint32_t * const amount) {
+    static const char * const names[] = { "newline", "size", "time" };
+
+    for (int policy = FLUSH_NEWLINE; policy <= FLUSH_TIME; policy++) {
+        const size_t length = strlen(names[policy]);
+        if (strncmp(string, names[policy], length) != 0) continue;
+
+        *amount = 0;
+        if (string[length] == '\0') return policy;
+        if (string[length] != '=' || policy == FLUSH_NEWLINE) break;
+
+        const uint64_t limit = parseLimit(string + length + 1);
+        if (!limit || limit > UINT32_MAX) break;
+        *amount = limit;
+        return policy;
+    }
+
+    printf("Invalid flush policy: %s\n", string);
+    exit(1);
+}
+
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("Expected 1 input parameter, got %d\n", argc - 1);
+    const char* fileName = NULL;
+    const char* manifestName = NULL;
+    uint64_t clockRate = DEFAULT_CLOCK_RATE;
+    uint32_t threadCount = 0;
+    bool lockstep = false;
+    uint64_t instructionLimit = 0;
+    uint64_t cycleLimit = 0;
+    uint64_t rewindCycles = 0;
+    const char* dumpName = NULL;
+    const char* snapshotName = NULL;
+    const char* recordName = NULL;
+    const char* replayName = NULL;
+    const char* convertName = NULL;
+    // Like stdio, output to a terminal is written out a line at a time, and output to a file in blocks
+    flushPolicy consoleFlush = isatty(fileno(stdout)) ? FLUSH_NEWLINE : FLUSH_SIZE;
+    uint32_t consoleFlushAmount = 0;
+    bool consoleDrop = false;
+    bool clockSet = false;
+
+    #ifdef HEADLESS
+    bool headless = true; // Builds without GLFW can't open a window
+    #else
+    bool headless = false;
+    #endif
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--clock") == 0) {
+            if (++i == argc) {
+                printf("Expected a clock rate in MHz after --clock\n");
+                exit(1);
+            }
+            clockRate = parseClockRate(argv[i]);
+            clockSet = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            if (++i == argc) {
+                printf("Expected a manifest file after --batch\n");
+                exit(1);
+            }
+            manifestName = argv[i];
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (++i == argc) {
+                printf("Expected a thread count after --threads\n");
+                exit(1);
+            }
+            threadCount = parseThreadCount(argv[i]);
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--max-instructions") == 0) {
+            if (++i == argc) {
+                printf("Expected an instruction count after --max-instructions\n");
+                exit(1);
+            }
+            instructionLimit = parseLimit(argv[i]);
+        } else if (strcmp(argv[i], "--max-cycles") == 0) {
+            if (++i == argc) {
+                printf("Expected a cycle count after --max-cycles\n");
+                exit(1);
+            }
+            cycleLimit = parseLimit(argv[i]);
+        } else if (strcmp(argv[i], "--rewind") == 0) {
+            if (++i == argc) {
+                printf("Expected a cycle count after --rewind\n");
+                exit(1);
+            }
+            rewindCycles = parseLimit(argv[i]);
+        } else if (strcmp(argv[i], "--dump-fb") == 0) {
+            if (++i == argc) {
+                printf("Expected an output file after --dump-fb\n");
+                exit(1);
+            }
+            dumpName = argv[i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0) {
+            if (++i == argc) {
+                printf("Expected an output file after --save-snapshot\n");
+                exit(1);
+            }
+            snapshotName = argv[i];
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (++i == argc) {
+                printf("Expected an output file after --record\n");
+                exit(1);
+            }
+            recordName = argv[i];
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            if (++i == argc) {
+                printf("Expected a recording after --replay\n");
+                exit(1);
+            }
+            replayName = argv[i];
+            headless = true; // Replays take their keys from the recording, so there's no need for a window
+        } else if (strcmp(argv[i], "--convert") == 0) {
+            if (++i == argc) {
+                printf("Expected an output file after --convert\n");
+                exit(1);
+            }
+            convertName = argv[i];
+        } else if (strcmp(argv[i], "--console-flush") == 0) {
+            if (++i == argc) {
+                printf("Expected a flush policy after --console-flush\n");
+                exit(1);
+            }
+            consoleFlush = parseFlushPolicy(argv[i], &consoleFlushAmount);
+        } else if (strcmp(argv[i], "--console-drop") == 0) {
+            consoleDrop = true;
+        } else if (!fileName) {
+            fileName = argv[i];
+        } else {
+            printf("Unexpected parameter: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (manifestName) {
+        if (fileName) {
+            printf("Unexpected parameter: %s\n", fileName);
+            exit(1);
+        }
+
+        // Batches run without a window
+        runBatch(manifestName, threadCount, lockstep);
+        return 0;
+    }
+
+    if (!fileName) {
+        printf("Expected an input file\n");
+        exit(1);
+    }
+
+    if (headless && clockSet) {
+        printf("--clock can't be used without a window, headless runs are as fast as possible\n");
+        exit(1);
+    }
+
+    if (headless && recordName) {
+        printf("--record needs a window, headless runs have no keyboard\n");
+        exit(1);
+    }
+
+    // Rewinding runs forward from the history without the keys, so it wouldn't match the recording
+    if (replayName && rewindCycles) {
+        printf("--rewind can't be used with --replay\n");
+        exit(1);
+    }
+
+    if (!headless && (instructionLimit || cycleLimit || rewindCycles || dumpName)) {
+        printf("--max-instructions, --max-cycles, --rewind and --dump-fb need --headless\n");
         exit(1);
     }
 
+    // Converting only needs the image, nothing is run
+    if (convertName) {
+        if (isSnapshotFile(fileName)) {
+            printf("--convert needs an image, snapshots can't be converted\n");
+            exit(1);
+        }
+
+        uint8_t * const image = malloc(0x10000);
+        if (!image) {
+            printf("Failed to allocate memory for the image\n");
+            exit(1);
+        }
+        readFile(image, fileName);
+        writeImage(image, convertName);
+        free(image);
+        return 0;
+    }
+
     // Initialise
-    readFile(argv[1]);
-    PC = readWord(0xfffc);
+    // Snapshots carry on from where they were saved, images start from the reset vector
+    cpu6502 * const cpu = createCpu();
+    cpu->console = createConsole(stdout, consoleFlush, consoleFlushAmount, !consoleDrop);
+    snapshot * const snap = createSnapshot();
+    if (isSnapshotFile(fileName)) {
+        readSnapshot(snap, fileName);
+        restoreSnapshot(cpu, snap);
+    } else {
+        readFile(cpu->mem, fileName);
+        cpu->PC = readWord(cpu, 0xfffc);
+    }
+
+    #ifdef JIT
+    initJit(cpu);
+    #endif
+
+    if (headless) {
+        // Replays stop where the recording did, unless given a limit
+        if (replayName) {
+            attachKeyQueue(cpu, createKeyQueue());
+            const uint64_t end = loadReplay(cpu, replayName);
+            if (!instructionLimit && !cycleLimit) instructionLimit = end;
+        }
+
+        runHeadless(cpu, instructionLimit, cycleLimit, rewindCycles, dumpName);
+        if (snapshotName) {
+            saveSnapshot(snap, cpu);
+            writeSnapshot(snap, snapshotName);
+        }
+        destroySnapshot(snap);
+        if (cpu->keys) destroyKeyQueue(cpu->keys);
+        destroyConsole(cpu->console);
+        destroyCpu(cpu);
+        return 0;
+    }
+
+    #ifdef HEADLESS
+    (void)clockRate; // Only runs with a window are governed
+    #else
+    initGovernor(cpu, clockRate);
+    attachFrameExchange(cpu, createFrameExchange());
+    attachKeyQueue(cpu, createKeyQueue());
+
+    // Going back in time isn't something a replay could repeat, so there's no rewinding while recording
+    // Entries are spaced in emulated time, an unlimited clock spaces them as the default clock rate would
+    if (recordName) {
+        startRecording(cpu, recordName);
+    } else {
+        history = createRewind((clockRate ? clockRate : DEFAULT_CLOCK_RATE) / REWIND_RATE, REWIND_MEMORY);
+    }
 
     initDisplay();
+    glfwSetWindowUserPointer(window, cpu);
     glfwSetKeyCallback(window, keyCallback);
+    glfwSetWindowRefreshCallback(window, refreshCallback);
 
     glClear(GL_COLOR_BUFFER_BIT);
     glfwSwapBuffers(window);
@@ -48,25 +393,44 @@ int main(int argc, char** argv) {
     // Windows freezes the main thread when the window is grabbed
     // Run the emulation on another thread to circumvent this
     pthread_t emulateThread;
-    pthread_create(&emulateThread, NULL, &emulate, NULL);
+    pthread_create(&emulateThread, NULL, &emulate, cpu);
 
     while (!glfwWindowShouldClose(window)) {
-        // Render screen
+        uint64_t dirtyRows = 0;
+        const uint8_t * const frame = takeFrame(cpu->frames, &dirtyRows);
 
-        for (uint16_t i = 0xe000; i < 0xf000; i++) {
-            const uint8_t byte = mem[i];
-            glUniform4f(colourUniform, (float)((byte & 0xe0) >> 5) / 7.0f, (float)((byte & 0x1c) >> 2) / 7.0f, (float)(byte & 0x03) / 3.0f, 1.0f);
-            glUniform2f(positionUniform, (float)((i - 0xe000) & 0x3f), (float)((i - 0xe000) >> 6));
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, NULL);
-        }
-
-        glfwSwapBuffers(window);
+        // A frame with no changed rows looks the same as the one already shown
+        if ((frame && dirtyRows) || redraw) {
+            // Render screen
+            // With no new frame, the texture still holds the last one
+            drawFramebuffer(frame, frame ? dirtyRows : 0);
+            glfwSwapBuffers(window);
+            redraw = false;
 
-        glfwPollEvents();
+            glfwPollEvents();
+        } else {
+            // Nothing has changed, so keep showing the last frame
+            // Sleep for a frame rather than waiting on vsync, waking early for input
+            glfwWaitEventsTimeout(IDLE_FRAME_TIME);
+        }
     }
 
+    stopGovernor();
     pthread_join(emulateThread, NULL);
+    if (recordName) stopRecording(cpu);
+
+    if (snapshotName) {
+        saveSnapshot(snap, cpu);
+        writeSnapshot(snap, snapshotName);
+    }
+    destroySnapshot(snap);
 
+    if (history) destroyRewind(history);
+    destroyFrameExchange(cpu->frames);
+    destroyKeyQueue(cpu->keys);
+    destroyConsole(cpu->console);
+    destroyCpu(cpu);
     glfwTerminate();
+    #endif
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+// The instruction, addressing mode and timing of each opcode,
+// for code that looks at instructions rather than running them through the handlers in instructions.c
+// The enum names clash with the handlers, so this can't be included alongside instructions.h
+// Include emulate.h before this file
+
+enum {
+    ADC, ALR, ANC, AND, ANE, ARR, ASL, ASLA, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK,
+    BVC, BVS, CLC, CLD, CLI, CLV, CMP, CPX, CPY, DCP, DEC, DEX, DEY, DOP, EOR, INC,
+    INX, INY, ISC, JAM, JMP, JSR, LAS, LAX, LDA, LDX, LDY, LSR, LSRA, LXA, NOP, ORA,
+    PHA, PHP, PLA, PLP, RLA, ROL, ROLA, ROR, RORA, RRA, RTI, RTS, SAX, SBC, SBX, SEC,
+    SED, SEI, SHA, SHX, SHY, SLO, SRE, STA, STX, STY, TAS, TAX, TAY, TOP, TSX, TXA,
+    TXS, TYA
+};
+
+enum {
+    MODE_IMP, MODE_IMM, MODE_REL, MODE_ZP, MODE_ZPX, MODE_ZPY,
+    MODE_ABS, MODE_ABSX, MODE_ABSY, MODE_IND, MODE_INDX, MODE_INDY
+};
+
+static const struct {
+    uint8_t instruction;
+    uint8_t mode;
+    uint8_t length;
+    uint8_t cycles;
+    bool page; // Takes an extra cycle when indexing crosses a page
+} opcodeInfo[0x100] = {
+    #define OPCODE(op, ins, mode, cycles, page) [op] = { ins, MODE_##mode, LENGTH_##mode, cycles, page },
+    #include "opcodes.h"
+};
\ No newline at end of file
@@ -0,0 +1,264 @@
+// Opcode table used to generate the dispatch code in emulate.c
+// Each entry is OPCODE(opcode, instruction, addressing mode, cycles, page cycle)
+// cycles is the NMOS cycle count, not including extra cycles for taken branches
+// page cycle is 1 if the instruction takes an extra cycle when indexing crosses a page
+// Define OPCODE before including this file
+
+OPCODE(0x00, BRK, IMP, 7, 0)
+OPCODE(0x01, ORA, INDX, 6, 0)
+OPCODE(0x02, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x03, SLO, INDX, 8, 0)   // Illegal
+OPCODE(0x04, DOP, ZP, 3, 0)     // Illegal
+OPCODE(0x05, ORA, ZP, 3, 0)
+OPCODE(0x06, ASL, ZP, 5, 0)
+OPCODE(0x07, SLO, ZP, 5, 0)     // Illegal
+OPCODE(0x08, PHP, IMP, 3, 0)
+OPCODE(0x09, ORA, IMM, 2, 0)
+OPCODE(0x0a, ASLA, IMP, 2, 0)
+OPCODE(0x0b, ANC, IMM, 2, 0)    // Illegal
+OPCODE(0x0c, TOP, ABS, 4, 0)    // Illegal
+OPCODE(0x0d, ORA, ABS, 4, 0)
+OPCODE(0x0e, ASL, ABS, 6, 0)
+OPCODE(0x0f, SLO, ABS, 6, 0)    // Illegal
+OPCODE(0x10, BPL, REL, 2, 0)
+OPCODE(0x11, ORA, INDY, 5, 1)
+OPCODE(0x12, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x13, SLO, INDY, 8, 0)   // Illegal
+OPCODE(0x14, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0x15, ORA, ZPX, 4, 0)
+OPCODE(0x16, ASL, ZPX, 6, 0)
+OPCODE(0x17, SLO, ZPX, 6, 0)    // Illegal
+OPCODE(0x18, CLC, IMP, 2, 0)
+OPCODE(0x19, ORA, ABSY, 4, 1)
+OPCODE(0x1a, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0x1b, SLO, ABSY, 7, 0)   // Illegal
+OPCODE(0x1c, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0x1d, ORA, ABSX, 4, 1)
+OPCODE(0x1e, ASL, ABSX, 7, 0)
+OPCODE(0x1f, SLO, ABSX, 7, 0)   // Illegal
+OPCODE(0x20, JSR, ABS, 6, 0)
+OPCODE(0x21, AND, INDX, 6, 0)
+OPCODE(0x22, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x23, RLA, INDX, 8, 0)   // Illegal
+OPCODE(0x24, BIT, ZP, 3, 0)
+OPCODE(0x25, AND, ZP, 3, 0)
+OPCODE(0x26, ROL, ZP, 5, 0)
+OPCODE(0x27, RLA, ZP, 5, 0)     // Illegal
+OPCODE(0x28, PLP, IMP, 4, 0)
+OPCODE(0x29, AND, IMM, 2, 0)
+OPCODE(0x2a, ROLA, IMP, 2, 0)
+OPCODE(0x2b, ANC, IMM, 2, 0)    // Illegal
+OPCODE(0x2c, BIT, ABS, 4, 0)
+OPCODE(0x2d, AND, ABS, 4, 0)
+OPCODE(0x2e, ROL, ABS, 6, 0)
+OPCODE(0x2f, RLA, ABS, 6, 0)    // Illegal
+OPCODE(0x30, BMI, REL, 2, 0)
+OPCODE(0x31, AND, INDY, 5, 1)
+OPCODE(0x32, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x33, RLA, INDY, 8, 0)   // Illegal
+OPCODE(0x34, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0x35, AND, ZPX, 4, 0)
+OPCODE(0x36, ROL, ZPX, 6, 0)
+OPCODE(0x37, RLA, ZPX, 6, 0)    // Illegal
+OPCODE(0x38, SEC, IMP, 2, 0)
+OPCODE(0x39, AND, ABSY, 4, 1)
+OPCODE(0x3a, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0x3b, RLA, ABSY, 7, 0)   // Illegal
+OPCODE(0x3c, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0x3d, AND, ABSX, 4, 1)
+OPCODE(0x3e, ROL, ABSX, 7, 0)
+OPCODE(0x3f, RLA, ABSX, 7, 0)   // Illegal
+OPCODE(0x40, RTI, IMP, 6, 0)
+OPCODE(0x41, EOR, INDX, 6, 0)
+OPCODE(0x42, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x43, SRE, INDX, 8, 0)   // Illegal
+OPCODE(0x44, DOP, ZP, 3, 0)     // Illegal
+OPCODE(0x45, EOR, ZP, 3, 0)
+OPCODE(0x46, LSR, ZP, 5, 0)
+OPCODE(0x47, SRE, ZP, 5, 0)     // Illegal
+OPCODE(0x48, PHA, IMP, 3, 0)
+OPCODE(0x49, EOR, IMM, 2, 0)
+OPCODE(0x4a, LSRA, IMP, 2, 0)
+OPCODE(0x4b, ALR, IMM, 2, 0)    // Illegal
+OPCODE(0x4c, JMP, ABS, 3, 0)
+OPCODE(0x4d, EOR, ABS, 4, 0)
+OPCODE(0x4e, LSR, ABS, 6, 0)
+OPCODE(0x4f, SRE, ABS, 6, 0)    // Illegal
+OPCODE(0x50, BVC, REL, 2, 0)
+OPCODE(0x51, EOR, INDY, 5, 1)
+OPCODE(0x52, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x53, SRE, INDY, 8, 0)   // Illegal
+OPCODE(0x54, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0x55, EOR, ZPX, 4, 0)
+OPCODE(0x56, LSR, ZPX, 6, 0)
+OPCODE(0x57, SRE, ZPX, 6, 0)    // Illegal
+OPCODE(0x58, CLI, IMP, 2, 0)
+OPCODE(0x59, EOR, ABSY, 4, 1)
+OPCODE(0x5a, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0x5b, SRE, ABSY, 7, 0)   // Illegal
+OPCODE(0x5c, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0x5d, EOR, ABSX, 4, 1)
+OPCODE(0x5e, LSR, ABSX, 7, 0)
+OPCODE(0x5f, SRE, ABSX, 7, 0)   // Illegal
+OPCODE(0x60, RTS, IMP, 6, 0)
+OPCODE(0x61, ADC, INDX, 6, 0)
+OPCODE(0x62, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x63, RRA, INDX, 8, 0)   // Illegal
+OPCODE(0x64, DOP, ZP, 3, 0)     // Illegal
+OPCODE(0x65, ADC, ZP, 3, 0)
+OPCODE(0x66, ROR, ZP, 5, 0)
+OPCODE(0x67, RRA, ZP, 5, 0)     // Illegal
+OPCODE(0x68, PLA, IMP, 4, 0)
+OPCODE(0x69, ADC, IMM, 2, 0)
+OPCODE(0x6a, RORA, IMP, 2, 0)
+OPCODE(0x6b, ARR, IMM, 2, 0)    // Illegal
+OPCODE(0x6c, JMP, IND, 5, 0)
+OPCODE(0x6d, ADC, ABS, 4, 0)
+OPCODE(0x6e, ROR, ABS, 6, 0)
+OPCODE(0x6f, RRA, ABS, 6, 0)    // Illegal
+OPCODE(0x70, BVS, REL, 2, 0)
+OPCODE(0x71, ADC, INDY, 5, 1)
+OPCODE(0x72, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x73, RRA, INDY, 8, 0)   // Illegal
+OPCODE(0x74, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0x75, ADC, ZPX, 4, 0)
+OPCODE(0x76, ROR, ZPX, 6, 0)
+OPCODE(0x77, RRA, ZPX, 6, 0)    // Illegal
+OPCODE(0x78, SEI, IMP, 2, 0)
+OPCODE(0x79, ADC, ABSY, 4, 1)
+OPCODE(0x7a, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0x7b, RRA, ABSY, 7, 0)   // Illegal
+OPCODE(0x7c, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0x7d, ADC, ABSX, 4, 1)
+OPCODE(0x7e, ROR, ABSX, 7, 0)
+OPCODE(0x7f, RRA, ABSX, 7, 0)   // Illegal
+OPCODE(0x80, DOP, IMM, 2, 0)    // Illegal
+OPCODE(0x81, STA, INDX, 6, 0)
+OPCODE(0x82, DOP, IMM, 2, 0)    // Illegal
+OPCODE(0x83, SAX, INDX, 6, 0)   // Illegal
+OPCODE(0x84, STY, ZP, 3, 0)
+OPCODE(0x85, STA, ZP, 3, 0)
+OPCODE(0x86, STX, ZP, 3, 0)
+OPCODE(0x87, SAX, ZP, 3, 0)     // Illegal
+OPCODE(0x88, DEY, IMP, 2, 0)
+OPCODE(0x89, DOP, IMM, 2, 0)    // Illegal
+OPCODE(0x8a, TXA, IMP, 2, 0)
+OPCODE(0x8b, ANE, IMM, 2, 0)    // Illegal
+OPCODE(0x8c, STY, ABS, 4, 0)
+OPCODE(0x8d, STA, ABS, 4, 0)
+OPCODE(0x8e, STX, ABS, 4, 0)
+OPCODE(0x8f, SAX, ABS, 4, 0)    // Illegal
+OPCODE(0x90, BCC, REL, 2, 0)
+OPCODE(0x91, STA, INDY, 6, 0)
+OPCODE(0x92, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0x93, SHA, INDY, 6, 0)   // Illegal
+OPCODE(0x94, STY, ZPX, 4, 0)
+OPCODE(0x95, STA, ZPX, 4, 0)
+OPCODE(0x96, STX, ZPY, 4, 0)
+OPCODE(0x97, SAX, ZPY, 4, 0)    // Illegal
+OPCODE(0x98, TYA, IMP, 2, 0)
+OPCODE(0x99, STA, ABSY, 5, 0)
+OPCODE(0x9a, TXS, IMP, 2, 0)
+OPCODE(0x9b, TAS, ABSY, 5, 0)   // Illegal
+OPCODE(0x9c, SHY, ABSX, 5, 0)   // Illegal
+OPCODE(0x9d, STA, ABSX, 5, 0)
+OPCODE(0x9e, SHX, ABSY, 5, 0)   // Illegal
+OPCODE(0x9f, SHA, ABSY, 5, 0)   // Illegal
+OPCODE(0xa0, LDY, IMM, 2, 0)
+OPCODE(0xa1, LDA, INDX, 6, 0)
+OPCODE(0xa2, LDX, IMM, 2, 0)
+OPCODE(0xa3, LAX, INDX, 6, 0)   // Illegal
+OPCODE(0xa4, LDY, ZP, 3, 0)
+OPCODE(0xa5, LDA, ZP, 3, 0)
+OPCODE(0xa6, LDX, ZP, 3, 0)
+OPCODE(0xa7, LAX, ZP, 3, 0)     // Illegal
+OPCODE(0xa8, TAY, IMP, 2, 0)
+OPCODE(0xa9, LDA, IMM, 2, 0)
+OPCODE(0xaa, TAX, IMP, 2, 0)
+OPCODE(0xab, LXA, IMM, 2, 0)    // Illegal
+OPCODE(0xac, LDY, ABS, 4, 0)
+OPCODE(0xad, LDA, ABS, 4, 0)
+OPCODE(0xae, LDX, ABS, 4, 0)
+OPCODE(0xaf, LAX, ABS, 4, 0)    // Illegal
+OPCODE(0xb0, BCS, REL, 2, 0)
+OPCODE(0xb1, LDA, INDY, 5, 1)
+OPCODE(0xb2, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0xb3, LAX, INDY, 5, 1)   // Illegal
+OPCODE(0xb4, LDY, ZPX, 4, 0)
+OPCODE(0xb5, LDA, ZPX, 4, 0)
+OPCODE(0xb6, LDX, ZPY, 4, 0)
+OPCODE(0xb7, LAX, ZPY, 4, 0)    // Illegal
+OPCODE(0xb8, CLV, IMP, 2, 0)
+OPCODE(0xb9, LDA, ABSY, 4, 1)
+OPCODE(0xba, TSX, IMP, 2, 0)
+OPCODE(0xbb, LAS, ABSY, 4, 1)   // Illegal
+OPCODE(0xbc, LDY, ABSX, 4, 1)
+OPCODE(0xbd, LDA, ABSX, 4, 1)
+OPCODE(0xbe, LDX, ABSY, 4, 1)
+OPCODE(0xbf, LAX, ABSY, 4, 1)   // Illegal
+OPCODE(0xc0, CPY, IMM, 2, 0)
+OPCODE(0xc1, CMP, INDX, 6, 0)
+OPCODE(0xc2, DOP, IMM, 2, 0)    // Illegal
+OPCODE(0xc3, DCP, INDX, 8, 0)   // Illegal
+OPCODE(0xc4, CPY, ZP, 3, 0)
+OPCODE(0xc5, CMP, ZP, 3, 0)
+OPCODE(0xc6, DEC, ZP, 5, 0)
+OPCODE(0xc7, DCP, ZP, 5, 0)     // Illegal
+OPCODE(0xc8, INY, IMP, 2, 0)
+OPCODE(0xc9, CMP, IMM, 2, 0)
+OPCODE(0xca, DEX, IMP, 2, 0)
+OPCODE(0xcb, SBX, IMM, 2, 0)    // Illegal
+OPCODE(0xcc, CPY, ABS, 4, 0)
+OPCODE(0xcd, CMP, ABS, 4, 0)
+OPCODE(0xce, DEC, ABS, 6, 0)
+OPCODE(0xcf, DCP, ABS, 6, 0)    // Illegal
+OPCODE(0xd0, BNE, REL, 2, 0)
+OPCODE(0xd1, CMP, INDY, 5, 1)
+OPCODE(0xd2, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0xd3, DCP, INDY, 8, 0)   // Illegal
+OPCODE(0xd4, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0xd5, CMP, ZPX, 4, 0)
+OPCODE(0xd6, DEC, ZPX, 6, 0)
+OPCODE(0xd7, DCP, ZPX, 6, 0)    // Illegal
+OPCODE(0xd8, CLD, IMP, 2, 0)
+OPCODE(0xd9, CMP, ABSY, 4, 1)
+OPCODE(0xda, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0xdb, DCP, ABSY, 7, 0)   // Illegal
+OPCODE(0xdc, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0xdd, CMP, ABSX, 4, 1)
+OPCODE(0xde, DEC, ABSX, 7, 0)
+OPCODE(0xdf, DCP, ABSX, 7, 0)   // Illegal
+OPCODE(0xe0, CPX, IMM, 2, 0)
+OPCODE(0xe1, SBC, INDX, 6, 0)
+OPCODE(0xe2, DOP, IMM, 2, 0)    // Illegal
+OPCODE(0xe3, ISC, INDX, 8, 0)   // Illegal
+OPCODE(0xe4, CPX, ZP, 3, 0)
+OPCODE(0xe5, SBC, ZP, 3, 0)
+OPCODE(0xe6, INC, ZP, 5, 0)
+OPCODE(0xe7, ISC, ZP, 5, 0)     // Illegal
+OPCODE(0xe8, INX, IMP, 2, 0)
+OPCODE(0xe9, SBC, IMM, 2, 0)
+OPCODE(0xea, NOP, IMP, 2, 0)
+OPCODE(0xeb, SBC, IMM, 2, 0)    // Illegal
+OPCODE(0xec, CPX, ABS, 4, 0)
+OPCODE(0xed, SBC, ABS, 4, 0)
+OPCODE(0xee, INC, ABS, 6, 0)
+OPCODE(0xef, ISC, ABS, 6, 0)    // Illegal
+OPCODE(0xf0, BEQ, REL, 2, 0)
+OPCODE(0xf1, SBC, INDY, 5, 1)
+OPCODE(0xf2, JAM, IMP, 2, 0)    // Illegal
+OPCODE(0xf3, ISC, INDY, 8, 0)   // Illegal
+OPCODE(0xf4, DOP, ZPX, 4, 0)    // Illegal
+OPCODE(0xf5, SBC, ZPX, 4, 0)
+OPCODE(0xf6, INC, ZPX, 6, 0)
+OPCODE(0xf7, ISC, ZPX, 6, 0)    // Illegal
+OPCODE(0xf8, SED, IMP, 2, 0)
+OPCODE(0xf9, SBC, ABSY, 4, 1)
+OPCODE(0xfa, NOP, IMP, 2, 0)    // Illegal
+OPCODE(0xfb, ISC, ABSY, 7, 0)   // Illegal
+OPCODE(0xfc, TOP, ABSX, 4, 1)   // Illegal
+OPCODE(0xfd, SBC, ABSX, 4, 1)
+OPCODE(0xfe, INC, ABSX, 7, 0)
+OPCODE(0xff, ISC, ABSX, 7, 0)   // Illegal
+
+#undef OPCODE
\ No newline at end of file
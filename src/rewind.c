@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "emulate.h"
+#include "snapshot.h"
+#include "rewind.h"
+
+// Rewind history
+//
+// Entries are kept oldest to newest in a linked list.
+// A keyframe holds a whole snapshot, the entries after it only hold the pages that changed since the entry before.
+// The CPU marks each page it stores to, so only those pages are compared against the last entry,
+// and pages that were written with the same bytes again aren't kept.
+//
+// Going back to an entry starts from the keyframe before it and applies each delta in turn,
+// which is at most REWIND_KEYFRAME_INTERVAL entries of a few pages each.
+// When the history grows past its memory limit the oldest keyframe and its deltas are dropped together,
+// since the deltas are no use without it.
+
+#define REWIND_KEYFRAME_INTERVAL 64 // Entries from one keyframe to the next
+
+typedef struct rewindEntry {
+    struct rewindEntry* older;
+    struct rewindEntry* newer;
+    uint64_t cycles;
+    uint8_t header[SNAPSHOT_HEADER_SIZE];
+    snapshot* keyframe; // NULL for a delta
+    uint32_t pageCount;
+    uint8_t pages[]; // Each changed page is its page number followed by its 256 bytes
+} rewindEntry;
+
+#define STORED_PAGE_SIZE (1 + 0x100)
+#define REWIND_SLICE 0x10000 // Most instructions run at once going forward from an entry
+
+struct rewindBuffer {
+    rewindEntry* oldest;
+    rewindEntry* newest;
+    uint64_t interval;
+    size_t memoryUsed;
+    size_t memoryLimit;
+    uint32_t sinceKeyframe; // Deltas since the newest keyframe
+    uint8_t mem[0x10000]; // Memory as of the newest entry, for finding which written pages changed
+    snapshot* working; // Where entries are put back together before restoring
+};
+
+rewindBuffer* createRewind(const uint64_t interval, const size_t memoryLimit) {
+    rewindBuffer * const buffer = calloc(1, sizeof(rewindBuffer));
+    if (!buffer) {
+        printf("Failed to allocate memory for the rewind buffer\n");
+        exit(1);
+    }
+
+    buffer->interval = interval ? interval : 1;
+    buffer->memoryLimit = memoryLimit;
+    buffer->working = createSnapshot();
+    return buffer;
+}
+
+static size_t getEntrySize(const rewindEntry * const entry) {
+    return sizeof(rewindEntry) + entry->pageCount * STORED_PAGE_SIZE + (entry->keyframe ? SNAPSHOT_HEADER_SIZE + 0x10000 : 0);
+}
+
+static void destroyEntry(rewindBuffer * const buffer, rewindEntry * const entry) {
+    buffer->memoryUsed -= getEntrySize(entry);
+    if (entry->keyframe) destroySnapshot(entry->keyframe);
+    free(entry);
+}
+
+void destroyRewind(rewindBuffer * const buffer) {
+    rewindEntry* entry = buffer->oldest;
+    while (entry) {
+        rewindEntry * const newer = entry->newer;
+        destroyEntry(buffer, entry);
+        entry = newer;
+    }
+
+    destroySnapshot(buffer->working);
+    free(buffer);
+}
+
+static rewindEntry* allocateEntry(const uint32_t pageCount) {
+    rewindEntry * const entry = malloc(sizeof(rewindEntry) + pageCount * STORED_PAGE_SIZE);
+    if (!entry) {
+        printf("Failed to allocate memory for the rewind buffer\n");
+        exit(1);
+    }
+
+    entry->pageCount = pageCount;
+    entry->keyframe = NULL;
+    return entry;
+}
+
+static rewindEntry* createKeyframe(rewindBuffer * const buffer, cpu6502 * const cpu) {
+    rewindEntry * const entry = allocateEntry(0);
+    entry->keyframe = createSnapshot();
+    saveSnapshot(entry->keyframe, cpu);
+    memcpy(buffer->mem, cpu->mem, 0x10000);
+    buffer->sinceKeyframe = 0;
+    return entry;
+}
+
+static rewindEntry* createDelta(rewindBuffer * const buffer, cpu6502 * const cpu) {
+    // Find the pages that really changed first, so the entry can be allocated at its final size
+    uint8_t changed[0x100];
+    uint32_t pageCount = 0;
+    for (uint32_t page = 0; page < 0x100; page++) {
+        if (!cpu->writtenPages[page]) continue;
+        if (memcmp(&cpu->mem[page << 8], &buffer->mem[page << 8], 0x100) != 0) changed[pageCount++] = page;
+    }
+
+    rewindEntry * const entry = allocateEntry(pageCount);
+    for (uint32_t i = 0; i < pageCount; i++) {
+        uint8_t * const stored = &entry->pages[i * STORED_PAGE_SIZE];
+        stored[0] = changed[i];
+        memcpy(&stored[1], &cpu->mem[changed[i] << 8], 0x100);
+        memcpy(&buffer->mem[changed[i] << 8], &stored[1], 0x100);
+    }
+
+    buffer->sinceKeyframe++;
+    return entry;
+}
+
+// Drops the oldest keyframe and its deltas, unless they're all that's left
+static bool dropOldest(rewindBuffer * const buffer) {
+    rewindEntry* next = buffer->oldest->newer;
+    while (next && !next->keyframe) next = next->newer;
+    if (!next) return false;
+
+    while (buffer->oldest != next) {
+        rewindEntry * const oldest = buffer->oldest;
+        buffer->oldest = oldest->newer;
+        destroyEntry(buffer, oldest);
+    }
+    next->older = NULL;
+    return true;
+}
+
+void recordRewind(rewindBuffer * const buffer, cpu6502 * const cpu) {
+    if (buffer->newest && cpu->cycles - buffer->newest->cycles < buffer->interval) return;
+
+    rewindEntry * const entry = !buffer->newest || buffer->sinceKeyframe + 1 >= REWIND_KEYFRAME_INTERVAL
+        ? createKeyframe(buffer, cpu)
+        : createDelta(buffer, cpu);
+    memset(cpu->writtenPages, 0, sizeof cpu->writtenPages);
+
+    entry->cycles = cpu->cycles;
+    saveSnapshotHeader(entry->header, cpu);
+    entry->older = buffer->newest;
+    entry->newer = NULL;
+    if (buffer->newest) buffer->newest->newer = entry;
+    else buffer->oldest = entry;
+    buffer->newest = entry;
+
+    buffer->memoryUsed += getEntrySize(entry);
+    while (buffer->memoryUsed > buffer->memoryLimit && dropOldest(buffer)) {}
+}
+
+// Puts cpu into the state of target, and forgets the entries after it
+static void restoreEntry(rewindBuffer * const buffer, cpu6502 * const cpu, rewindEntry * const target) {
+    rewindEntry* keyframe = target;
+    buffer->sinceKeyframe = 0;
+    while (!keyframe->keyframe) {
+        keyframe = keyframe->older;
+        buffer->sinceKeyframe++;
+    }
+
+    uint8_t * const mem = getSnapshotMemory(buffer->working);
+    memcpy(mem, getSnapshotMemory(keyframe->keyframe), 0x10000);
+    for (const rewindEntry* delta = keyframe->newer; delta != target->newer; delta = delta->newer) {
+        for (uint32_t i = 0; i < delta->pageCount; i++) {
+            const uint8_t * const stored = &delta->pages[i * STORED_PAGE_SIZE];
+            memcpy(&mem[stored[0] << 8], &stored[1], 0x100);
+        }
+    }
+    memcpy(getSnapshotHeader(buffer->working), target->header, SNAPSHOT_HEADER_SIZE);
+
+    restoreSnapshot(cpu, buffer->working);
+    memcpy(buffer->mem, mem, 0x10000);
+    memset(cpu->writtenPages, 0, sizeof cpu->writtenPages);
+
+    while (buffer->newest != target) {
+        rewindEntry * const newest = buffer->newest;
+        buffer->newest = newest->older;
+        destroyEntry(buffer, newest);
+    }
+    target->newer = NULL;
+}
+
+bool stepBack(rewindBuffer * const buffer, cpu6502 * const cpu) {
+    rewindEntry* target = buffer->newest;
+    while (target && target->cycles >= cpu->cycles) target = target->older;
+    if (!target) return false;
+
+    restoreEntry(buffer, cpu, target);
+    return true;
+}
+
+bool rewindTo(rewindBuffer * const buffer, cpu6502 * const cpu, const uint64_t cycles) {
+    rewindEntry* target = buffer->newest;
+    while (target && target->cycles > cycles) target = target->older;
+    if (!target) return false;
+
+    restoreEntry(buffer, cpu, target);
+
+    // Stops like a run with a cycle limit, at the first instruction to reach it
+    // The target is below the cycle limit of the run that recorded the history, so that's put back afterwards
+    if (cpu->cycles < cycles) {
+        const uint64_t cycleLimit = cpu->cycleLimit;
+        setCycleLimit(cpu, cycles);
+        while (runInstructions(cpu, REWIND_SLICE)) {}
+        setCycleLimit(cpu, cycleLimit);
+    }
+    return true;
+}
\ No newline at end of file
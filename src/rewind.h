@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A history of recent states, for stepping backwards through a run
+// Each entry is only the pages that changed since the one before, with a full keyframe now and then
+typedef struct rewindBuffer rewindBuffer;
+
+#define REWIND_RATE 10 // Entries per second of emulated time
+#define REWIND_MEMORY 0x400000 // 4MiB, the oldest history is dropped to stay under this
+
+// interval is the cycles between entries, memoryLimit is roughly the most bytes of history kept
+rewindBuffer* createRewind(uint64_t interval, size_t memoryLimit);
+void destroyRewind(rewindBuffer* buffer);
+
+// Adds an entry for the current state if interval cycles have passed since the last one
+// Call between runs of instructions, it's cheap when there's nothing to do
+void recordRewind(rewindBuffer* buffer, cpu6502* cpu);
+
+// Goes back to the newest entry before the current state, and forgets everything after it
+// Returns false, leaving cpu alone, if there's nothing older
+bool stepBack(rewindBuffer* buffer, cpu6502* cpu);
+
+// Goes back to the given cycle count, by restoring the newest entry before it and running forward
+// The CPU ends at the first instruction to reach the count, as a run with it as the cycle limit does
+// Returns false, leaving cpu alone, if that's further back than the history goes
+bool rewindTo(rewindBuffer* buffer, cpu6502* cpu, uint64_t cycles);
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "emulate.h"
+#include "scheduler.h"
+
+// Device events
+//
+// Devices that do something at a point in emulated time, like the timer, schedule an event for that cycle count
+// rather than being checked after every instruction. Scheduled events are kept in a binary min-heap by cycle,
+// so the soonest is always at the top, and the CPU's deadline is never later than it.
+// The interpreter only compares the cycle count with the deadline, and runEvents is called once it's reached.
+//
+// Scheduling an event sooner than the deadline brings the deadline forward straight away.
+// Moving one later leaves the deadline where it is, which only means runEvents is called early and finds nothing due,
+// then updateDeadline puts it back where it belongs.
+
+static void swapEvents(cpu6502 * const cpu, const uint8_t a, const uint8_t b) {
+    const uint8_t event = cpu->eventHeap[a];
+    cpu->eventHeap[a] = cpu->eventHeap[b];
+    cpu->eventHeap[b] = event;
+    cpu->eventPositions[cpu->eventHeap[a]] = a;
+    cpu->eventPositions[cpu->eventHeap[b]] = b;
+}
+
+static uint64_t getHeapCycle(const cpu6502 * const cpu, const uint8_t position) {
+    return cpu->eventCycles[cpu->eventHeap[position]];
+}
+
+static void siftUp(cpu6502 * const cpu, uint8_t position) {
+    while (position > 0) {
+        const uint8_t parent = (position - 1) / 2;
+        if (getHeapCycle(cpu, parent) <= getHeapCycle(cpu, position)) return;
+        swapEvents(cpu, parent, position);
+        position = parent;
+    }
+}
+
+static void siftDown(cpu6502 * const cpu, uint8_t position) {
+    for (;;) {
+        const uint8_t left = position * 2 + 1;
+        const uint8_t right = left + 1;
+        uint8_t soonest = position;
+        if (left < cpu->scheduledCount && getHeapCycle(cpu, left) < getHeapCycle(cpu, soonest)) soonest = left;
+        if (right < cpu->scheduledCount && getHeapCycle(cpu, right) < getHeapCycle(cpu, soonest)) soonest = right;
+        if (soonest == position) return;
+        swapEvents(cpu, position, soonest);
+        position = soonest;
+    }
+}
+
+static void removeEvent(cpu6502 * const cpu, const uint8_t event) {
+    const uint8_t position = cpu->eventPositions[event];
+    const uint8_t last = --cpu->scheduledCount;
+    cpu->eventCycles[event] = UINT64_MAX;
+    if (position == last) return;
+
+    // The last event in the heap takes its place, where it can belong further up or further down
+    const uint8_t moved = cpu->eventHeap[last];
+    swapEvents(cpu, position, last);
+    siftUp(cpu, position);
+    siftDown(cpu, cpu->eventPositions[moved]);
+}
+
+uint8_t addEvent(cpu6502 * const cpu, const eventHandler handler) {
+    if (cpu->eventCount == MAX_EVENTS) {
+        printf("Too many events, at most %d can be added\n", MAX_EVENTS);
+        exit(1);
+    }
+
+    const uint8_t event = cpu->eventCount++;
+    cpu->eventHandlers[event] = handler;
+    cpu->eventCycles[event] = UINT64_MAX;
+    return event;
+}
+
+void scheduleEvent(cpu6502 * const cpu, const uint8_t event, const uint64_t cycle) {
+    if (cpu->eventCycles[event] != UINT64_MAX) removeEvent(cpu, event);
+    if (cycle == UINT64_MAX) return;
+
+    cpu->eventCycles[event] = cycle;
+    cpu->eventHeap[cpu->scheduledCount] = event;
+    cpu->eventPositions[event] = cpu->scheduledCount;
+    siftUp(cpu, cpu->scheduledCount++);
+
+    if (cycle < cpu->deadline) cpu->deadline = cycle;
+}
+
+uint64_t getEventCycle(const cpu6502 * const cpu, const uint8_t event) {
+    return cpu->eventCycles[event];
+}
+
+uint64_t getNextEvent(const cpu6502 * const cpu) {
+    return cpu->scheduledCount ? getHeapCycle(cpu, 0) : UINT64_MAX;
+}
+
+void runEvents(cpu6502 * const cpu) {
+    while (cpu->scheduledCount && getHeapCycle(cpu, 0) <= cpu->cycles) {
+        const uint8_t event = cpu->eventHeap[0];
+        const uint64_t cycle = cpu->eventCycles[event];
+        removeEvent(cpu, event);
+        cpu->eventHandlers[event](cpu, cycle);
+    }
+}
+
+void cancelEvents(cpu6502 * const cpu) {
+    for (uint8_t event = 0; event < cpu->eventCount; event++) cpu->eventCycles[event] = UINT64_MAX;
+    cpu->scheduledCount = 0;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include <stdint.h>
+
+// Adds an event for a device and returns its id, it isn't scheduled until scheduleEvent is called
+// Events are added before the CPU runs, along with the device's registers
+uint8_t addEvent(cpu6502* cpu, eventHandler handler);
+
+// Schedules the event for a cycle count, moving it if it's already scheduled, or unschedules it given UINT64_MAX
+void scheduleEvent(cpu6502* cpu, uint8_t event, uint64_t cycle);
+
+// The cycle count the event is scheduled for, UINT64_MAX if it isn't
+uint64_t getEventCycle(const cpu6502* cpu, uint8_t event);
+
+// The cycle count the soonest event is scheduled for, UINT64_MAX if none are
+uint64_t getNextEvent(const cpu6502* cpu);
+
+// Calls the handler of every event due by the current cycle count, soonest first
+// Each is unscheduled before its handler is called, so the handler can schedule it again
+void runEvents(cpu6502* cpu);
+
+// Unschedules every event, for resetCpu
+void cancelEvents(cpu6502* cpu);
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "emulate.h"
+#include "snapshot.h"
+#include "interrupts.h"
+#include "scheduler.h"
+
+// Save states
+//
+// A snapshot is one flat blob, a small header followed by all 64KiB of memory,
+// and it's the same blob in memory and on disk.
+// Multi-byte fields are little endian, so files can be moved between hosts.
+//
+// The header is laid out as
+//   0  "6502SNAP"
+//   8  version, 4 bytes
+//   12 cycles, 8 bytes
+//   20 PC, then 2 bytes of padding
+//   24 SP, AC, X, Y, P, halted, manualPresent, then a byte of padding
+//   32 cycle count the timer is next due at, 8 bytes
+//   40 timer period, 2 bytes
+//   42 interrupt status, interrupt enable, NMI pending, then 3 bytes of padding
+//   48 cycle count the next frame ends at if the frame counter is running, 8 bytes
+//   56 memory
+//
+// Bump SNAPSHOT_VERSION whenever the layout changes, old files are then refused rather than misread.
+
+#define SNAPSHOT_MAGIC "6502SNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_SIZE (SNAPSHOT_HEADER_SIZE + 0x10000)
+
+struct snapshot {
+    uint8_t data[SNAPSHOT_SIZE];
+};
+
+snapshot* createSnapshot(void) {
+    snapshot * const snap = calloc(1, sizeof(snapshot));
+    if (!snap) {
+        printf("Failed to allocate memory for the snapshot\n");
+        exit(1);
+    }
+    return snap;
+}
+
+void destroySnapshot(snapshot * const snap) {
+    free(snap);
+}
+
+static void putLittleEndian(uint8_t * const data, const uint64_t value, const uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) data[i] = value >> (i * 8);
+}
+
+static uint64_t getLittleEndian(const uint8_t * const data, const uint32_t size) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < size; i++) value |= (uint64_t)data[i] << (i * 8);
+    return value;
+}
+
+void saveSnapshotHeader(uint8_t * const data, const cpu6502 * const cpu) {
+    memcpy(data, SNAPSHOT_MAGIC, 8);
+    putLittleEndian(&data[8], SNAPSHOT_VERSION, 4);
+    putLittleEndian(&data[12], cpu->cycles, 8);
+    putLittleEndian(&data[20], cpu->PC, 2);
+    putLittleEndian(&data[22], 0, 2);
+    data[24] = cpu->SP;
+    data[25] = cpu->AC;
+    data[26] = cpu->X;
+    data[27] = cpu->Y;
+    data[28] = getStatus(cpu);
+    data[29] = cpu->halted;
+    data[30] = cpu->manualPresent;
+    data[31] = 0;
+    putLittleEndian(&data[32], getEventCycle(cpu, cpu->timerEvent), 8);
+    putLittleEndian(&data[40], cpu->timerPeriod, 2);
+    data[42] = cpu->interruptStatus;
+    data[43] = cpu->interruptEnable;
+    data[44] = cpu->nmiPending;
+    putLittleEndian(&data[45], 0, 3);
+    putLittleEndian(&data[48], getEventCycle(cpu, cpu->frameEvent), 8);
+}
+
+uint8_t* getSnapshotHeader(snapshot * const snap) {
+    return snap->data;
+}
+
+uint8_t* getSnapshotMemory(snapshot * const snap) {
+    return &snap->data[SNAPSHOT_HEADER_SIZE];
+}
+
+void saveSnapshot(snapshot * const snap, const cpu6502 * const cpu) {
+    saveSnapshotHeader(snap->data, cpu);
+    memcpy(&snap->data[SNAPSHOT_HEADER_SIZE], cpu->mem, 0x10000);
+}
+
+void restoreSnapshot(cpu6502 * const cpu, const snapshot * const snap) {
+    const uint8_t * const data = snap->data;
+    const uint8_t * const mem = &data[SNAPSHOT_HEADER_SIZE];
+
+    // Only bytes marked in the bitmap can be part of a cached instruction
+    // Most of the bitmap is empty, so it's skipped 64 bytes of memory at a time
+    for (uint32_t i = 0; i < 0x10000 / 8; i += 8) {
+        uint64_t marked;
+        memcpy(&marked, &cpu->codeBitmap[i], sizeof marked);
+        if (!marked) continue;
+
+        for (uint32_t address = i * 8; address < i * 8 + 64; address++) {
+            if (cpu->mem[address] != mem[address]) checkCodeWrite(cpu, address);
+        }
+    }
+    memcpy(cpu->mem, mem, 0x10000);
+    memset(cpu->writtenPages, 1, sizeof cpu->writtenPages);
+
+    cpu->cycles = getLittleEndian(&data[12], 8);
+    cpu->PC = getLittleEndian(&data[20], 2);
+    cpu->SP = data[24];
+    cpu->AC = data[25];
+    cpu->X = data[26];
+    cpu->Y = data[27];
+    setStatus(cpu, data[28]);
+    cpu->halted = data[29];
+    cpu->manualPresent = data[30];
+    scheduleEvent(cpu, cpu->timerEvent, getLittleEndian(&data[32], 8));
+    cpu->timerPeriod = getLittleEndian(&data[40], 2);
+    cpu->interruptStatus = data[42];
+    cpu->interruptEnable = data[43];
+    cpu->nmiPending = data[44];
+    scheduleEvent(cpu, cpu->frameEvent, getLittleEndian(&data[48], 8));
+    updateDeadline(cpu);
+    cpu->dirtyRows = ~0ULL; // The whole screen may have changed
+}
+
+void writeSnapshot(const snapshot * const snap, const char * const fileName) {
+    FILE * const file = fopen(fileName, "wb");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    if (fwrite(snap->data, 1, SNAPSHOT_SIZE, file) != SNAPSHOT_SIZE || fclose(file) != 0) {
+        printf("Failed to write file: %s\n", fileName);
+        exit(1);
+    }
+}
+
+void readSnapshot(snapshot * const snap, const char * const fileName) {
+    FILE * const file = fopen(fileName, "rb");
+    if (!file) {
+        printf("Failed to open file: %s\n", fileName);
+        exit(1);
+    }
+
+    const size_t size = fread(snap->data, 1, SNAPSHOT_SIZE, file);
+    const bool longer = getc(file) != EOF;
+    fclose(file);
+
+    if (size < SNAPSHOT_HEADER_SIZE || memcmp(snap->data, SNAPSHOT_MAGIC, 8) != 0) {
+        printf("Not a snapshot file: %s\n", fileName);
+        exit(1);
+    }
+
+    const uint32_t version = getLittleEndian(&snap->data[8], 4);
+    if (version != SNAPSHOT_VERSION) {
+        printf("Unsupported snapshot version %u in %s, expected %d\n", version, fileName, SNAPSHOT_VERSION);
+        exit(1);
+    }
+
+    if (size != SNAPSHOT_SIZE || longer) {
+        printf("Expected snapshot file to be %d bytes long: %s\n", SNAPSHOT_SIZE, fileName);
+        exit(1);
+    }
+}
+
+bool isSnapshotFile(const char * const fileName) {
+    FILE * const file = fopen(fileName, "rb");
+    if (!file) return false;
+
+    char magic[8];
+    const bool isSnapshot = fread(magic, 1, 8, file) == 8 && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    fclose(file);
+    return isSnapshot;
+}
\ No newline at end of file
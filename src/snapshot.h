@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// A copy of a machine's state, taken while it isn't running
+// The registers, memory, cycle count, present mode and interrupt state are kept, host devices like the keyboard queue aren't
+typedef struct snapshot snapshot;
+
+snapshot* createSnapshot(void);
+void destroySnapshot(snapshot* snap);
+
+// Copies the state of cpu into snap
+void saveSnapshot(snapshot* snap, const cpu6502* cpu);
+
+// Puts cpu back into the state in snap
+// Only cached code for bytes that differ is thrown away, so restoring the same snapshot again and again stays fast
+void restoreSnapshot(cpu6502* cpu, const snapshot* snap);
+
+// Snapshots are a header holding the registers followed by memory,
+// and can be put together a piece at a time, as the rewind buffer does when it only keeps pages that changed
+#define SNAPSHOT_HEADER_SIZE 56
+void saveSnapshotHeader(uint8_t* header, const cpu6502* cpu);
+uint8_t* getSnapshotHeader(snapshot* snap);
+uint8_t* getSnapshotMemory(snapshot* snap);
+
+// Snapshot files are the same bytes as in memory, so they load on any host
+void writeSnapshot(const snapshot* snap, const char* fileName);
+void readSnapshot(snapshot* snap, const char* fileName);
+
+// Whether the file starts like a snapshot, rather than being a memory image
+bool isSnapshotFile(const char* fileName);
\ No newline at end of file